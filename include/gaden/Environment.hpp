@@ -49,6 +49,9 @@ namespace gaden
         Vector3 coordsOfCellOrigin(const Vector3i& indices) const;
         ReadResult ReadFromFile(const std::filesystem::path& filePath);
 
+        // (re)builds the clearance field. Must be called again if the cells are modified
+        void ComputeClearance();
+
         bool WriteToFile(const std::filesystem::path& path);
         bool Write2DSlicePGM(const std::filesystem::path& path, float height, bool blockOutlets);
         bool WriteROSOccupancyYAML(const std::filesystem::path& path, float height);
@@ -62,6 +65,10 @@ namespace gaden
 
         std::vector<CellState> cells;
 
+        // distance field, one value per cell: a point anywhere inside the cell can move any distance shorter than this many cells, in any direction,
+        // without reaching a cell that is not free (obstacle, outlet, or out of bounds). Lets the simulation skip the collision and line of sight checks in open space
+        std::vector<uint8_t> clearance = {};
+
     private:
     };
 
@@ -1,6 +1,13 @@
 #pragma once
 #include "Simulation.hpp"
 #include "gaden/internal/BufferUtils.hpp"
+#include "gaden/internal/DecodedSnapshotCache.hpp"
+#include "gaden/internal/FilamentDelta.hpp"
+#include "gaden/internal/MappedFile.hpp"
+#include "gaden/internal/ResultsContainer.hpp"
+#include "gaden/internal/SnapshotPrefetcher.hpp"
+#include <deque>
+#include <optional>
 
 namespace gaden
 {
@@ -11,6 +18,17 @@ namespace gaden
         {
             size_t startIteration = 0;
             std::filesystem::path resultsDirectory;
+
+            // the upcoming iterations can be read and decompressed in background threads, so AdvanceTimestep() does not stall on the disk
+            size_t prefetchDepth = 0;        // number of iterations to read ahead. 0 -> no prefetching, each iteration is read inside AdvanceTimestep()
+            size_t prefetchMemoryBudget = 0; //[bytes] stop reading ahead once the prefetched iterations take this much memory. 0 -> only limited by prefetchDepth
+            size_t prefetchThreads = 1;
+
+            size_t keptFrames = 4; // decompressed iterations kept in memory, so going back to a recent one (StepBackward, seeking) does not read it again
+
+            // decompressed iterations also go into the process-wide DecodedSnapshotCache, so looping or playing the same results in several simulations only decompresses them once
+            // its size is set with DecodedSnapshotCache::Get().SetMemoryBudget()
+            bool sharedCache = true;
         };
         enum class Mode {Uninitialized, Filaments, Concentration}; // do the simulation result files contain the list of filaments, or pre-computed concentration maps?
 
@@ -18,25 +36,73 @@ namespace gaden
         PlaybackSimulation() = delete;
         PlaybackSimulation(Parameters params, EnvironmentConfiguration const& config, LoopConfig loop);
         void AdvanceTimestep() override;
-        const std::vector<Filament>& GetFilaments() const override;
+        std::span<const Filament> GetFilaments() const override;
         Mode GetMode() const {return mode;}
 
+        // random access. The requested iteration is loaded right away, and AdvanceTimestep() continues from the one after it
+        bool SeekToIteration(size_t iteration); // false if the iteration is not in the results
+        bool SeekToTime(double time);           //[s] simulation time. Goes to the last iteration that was saved at or before it
+        bool StepBackward();                    // loads the iteration before the current one (wrapping around if looping)
+
+        std::optional<size_t> GetLoadedIteration() const { return loadedIteration; }
+        // time, number of filaments and size of each saved iteration. Read from the results index, or built by listing the files if the results are from an older version of gaden
+        const std::vector<ResultsIndexEntry>& GetResultsIndex();
 
     private:
-        void LoadLogfile(BufferReader reader);
+        struct DecodedFrame
+        {
+            size_t iteration;
+            DecodedSnapshotCache::Handle snapshot;
+        };
+
+        bool LoadIteration(size_t iteration);
+        bool ReadIteration(size_t iteration);
+        DecodedFrame* FindDecodedFrame(size_t iteration);
+        const DecodedSnapshot* KeepFrame(size_t iteration, DecodedSnapshotCache::Handle snapshot);
+        DecodedSnapshotCache::Handle StoreDecoded(size_t iteration, std::vector<uint8_t>&& buffer, size_t size);
+        ResultsIndex& GetIndex();
+        size_t NextIteration(size_t iteration) const;
+        std::optional<size_t> PreviousIteration(size_t iteration) const;
+        std::filesystem::path SnapshotPath(size_t iteration) const;
+        bool ReadSnapshot(size_t iteration, const uint8_t*& data, size_t& dataSize);
+        bool DecodeSnapshot(ResultsContainerReader* reader, size_t iteration, std::vector<uint8_t>& output, size_t& outputSize) const;
+        void LoadLogfile(BufferReader reader, size_t iteration);
+        std::span<const Filament> ReadFilamentArray(BufferReader& reader);
         void LoadLogfileVersion1(BufferReader reader);
         void LoadLogfileVersionPre2_6(BufferReader reader);
         void LoadLogfileVersion2_6(BufferReader reader);
+        void LoadFilamentsVersion3_0(BufferReader& reader);
 
     private:
         Parameters parameters;
         LoopConfig loopConfig;
+        // filaments of the current iteration. Whenever possible, this points straight into the snapshot data (mapped file or one of the decodedFrames) without a copy
+        // older file formats need to be converted, and those are stored in activeFilaments
+        std::span<const Filament> filaments;
         std::vector<Filament> activeFilaments;
-        size_t currentIteration = 0;
+
+        // results saved as keyframes + deltas (see FilamentDelta.hpp): the last reconstructed snapshot, which the next delta is applied to
+        FilamentFrame reconstructed;
+        FilamentFrame deltaScratch;
+        std::optional<size_t> reconstructedIteration;
+        std::optional<size_t> missingKeyframe; // set while parsing a delta that does not follow the reconstructed snapshot
+        size_t currentIteration = 0;          // next iteration to be loaded by AdvanceTimestep()
+        std::optional<size_t> loadedIteration; // iteration whose data is currently loaded
         bool firstReading = true;
         Mode mode = Mode::Uninitialized;
 
-        std::vector<uint8_t> compressedBuffer;
-        std::vector<uint8_t> rawBuffer;
+        std::unique_ptr<ResultsContainerReader> container; // only if the results were saved as a single file. Otherwise, one file per iteration
+        MappedFile mappedSnapshot; // file of the current iteration, if the results are one file per iteration
+        ResultsIndex index;        // only loaded once it is needed for seeking
+        bool indexLoaded = false;
+
+        // the most recently decompressed (or prefetched) iterations, oldest first. They might be shared with other simulations through the DecodedSnapshotCache
+        // uncompressed snapshots are read in place from the mapped file, and are not kept here
+        std::deque<DecodedFrame> decodedFrames;
+        std::string cacheKey; // of the results directory, see DecodedSnapshotCache::DirectoryKey
+
+        // only if params.prefetchDepth > 0
+        std::vector<std::unique_ptr<ResultsContainerReader>> prefetchContainers; // one per prefetch thread, since the readers are not thread-safe
+        std::unique_ptr<SnapshotPrefetcher> prefetcher;
     };
 } // namespace gaden
\ No newline at end of file
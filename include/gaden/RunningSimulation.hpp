@@ -2,6 +2,11 @@
 #include "Simulation.hpp"
 #include "gaden/EnvironmentConfiguration.hpp"
 #include "gaden/datatypes/sources/PointSource.hpp"
+#include "gaden/internal/FilamentDelta.hpp"
+#include "gaden/internal/FilamentStore.hpp"
+#include "gaden/internal/QuantizedFilaments.hpp"
+#include "gaden/internal/ResultsWriter.hpp"
+#include <mutex>
 
 namespace gaden
 {
@@ -21,13 +26,27 @@ namespace gaden
             float filamentGrowthGamma = 10.0;     //[cm²/s] Growth ratio of the filament_std
             float filamentNoise_std = 0.01;       // STD to add some "variablity" to the filament location
             float numFilaments_sec = 10;          // How many filaments to release per second
-            size_t expectedNumIterations = 600;   // To give initial size to filament vector. If you run the simulator longer than this, there will be a reallocation -- so, bad for performance :_(
+            size_t expectedNumIterations = 600;   // DEPRECATED, has no effect. The filaments are stored in a pool that grows as needed, this is only kept so that code that sets it still compiles
+            float filamentMinPPMcenter = 0;       //[ppm] Filaments are removed once the concentration at their center drops below this value. 0 -> never
+            float filamentMaxAge = 0;             //[s] Filaments are removed once they have existed for this long (merged filaments: the average age of their gas, not the one implied by their sigma). 0 -> never
+            size_t maxActiveFilaments = 0;        // when there are more filaments than this, nearby ones get merged into larger filaments (with the same total amount of gas). 0 -> no limit
+            float mergeMinSigma = 1;              //[cells] only filaments that have grown at least this much (sigma, relative to the cell size) are merged, unless that is not enough to meet maxActiveFilaments
+            size_t maxCollisionBounces = 3;       // how many times a filament can slide along an obstacle in a single step. If it collides again after that, it stops at the contact point
+            uint64_t seed = 0;                    // seed for the filament noise and emission. Same seed and parameters -> same results, regardless of the number of threads
 
             LoopConfig windLoop;
 
             // you can query the simulation as it runs, or store the state of the gas dispersion to disk and play it back later
             bool saveResults = false;
             float saveDeltaTime = 0.5;
+            size_t saveQueueDepth = 2;               // snapshots that can wait to be compressed and written to disk in the background while the simulation keeps running
+                                                     // if the queue is full, AdvanceTimestep waits for a slot. 0 -> write them synchronously
+            bool saveSingleFile = false;             // append all the snapshots to a single file with an index (see ResultsContainer.hpp) instead of writing one file per iteration
+            size_t saveKeyframeInterval = 0;         // only every Nth snapshot stores all the filaments, the ones in between store what changed since the previous snapshot (see FilamentDelta.hpp)
+                                                     // much smaller results, but to play an iteration the previous ones have to be read back to the keyframe. 0 -> every snapshot is complete
+            bool saveQuantized = false;              // store the filaments with 16 bits of precision instead of 32 (see QuantizedFilaments.hpp for the error bounds). Less than half the size
+            CompressionCodec saveCompression = CompressionCodec::Zlib; // none, zlib, zstd or lz4. Playback detects it automatically
+            int saveCompressionLevel = 0;                             // 0 -> default level for the codec
             bool preCalculateConcentrations = false; // produce full concentration maps instead of serializing the filament positions. NOT RECOMMENDED!
                                                      // it is *way* slower and produces *much* larger files, but could be useful for some applications
             std::filesystem::path saveDataDirectory;
@@ -36,12 +55,38 @@ namespace gaden
             bool WriteToYAML(std::filesystem::path const& path);
         };
 
+        // cost of the last call to AdvanceTimestep, for profiling
+        struct StepStatistics
+        {
+            size_t movedFilaments = 0;         // active filaments that were moved this step. Not the ones that were retired before moving, or had been merged
+            size_t freeMoves = 0;              // filaments that were far enough from any obstacle to skip the collision checks
+            size_t exitedFilaments = 0;        // removed because they reached an outlet
+            size_t retiredFilaments = 0;       // removed because of filamentMinPPMcenter or filamentMaxAge
+            size_t mergedFilaments = 0;        // removed by merging them into others, because of maxActiveFilaments
+            size_t cellsTraversed = 0;         // total number of cells visited by the collision checks
+            size_t maxCellsTraversed = 0;      // worst case for a single filament
+            size_t collisions = 0;             // number of times a filament had to slide along an obstacle
+            size_t bounceLimitReached = 0;     // filaments that were stopped because they ran out of bounces
+        };
+
+        // memory used to store the filaments. It grows in fixed-size chunks as needed, and is reused once filaments are removed
+        struct FilamentPoolUsage
+        {
+            size_t filaments = 0; // currently alive
+            size_t capacity = 0;  // filaments that fit without allocating more memory
+            size_t bytes = 0;     // total allocated, including the per-step scratch arrays
+        };
+
     public:
         RunningSimulation(Parameters params, EnvironmentConfiguration const& envConfig);
         void AdvanceTimestep() override;
-        const std::vector<Filament>& GetFilaments() const override;
+        std::span<const Filament> GetFilaments() const override;
         float GetCurrentTime() { return currentTime; }
         const Parameters& GetParameters() { return parameters; }
+        const StepStatistics& GetStepStatistics() const { return stepStatistics; }
+        size_t GetNumRetiredFilaments() const { return numRetiredFilaments; }
+        FilamentPoolUsage GetFilamentPoolUsage() const;
+        void FlushResults(); // blocks until all the result snapshots produced so far are on disk. Also happens automatically on destruction
 
         Vector3 SampleWind(const Vector3i& indices) const override;
 
@@ -52,10 +97,14 @@ namespace gaden
 
     private:
         void AddFilaments();
+        void MergeFilaments();
         void MoveFilaments();
-        void MoveSingleFilament(Filament& filament);
-        Environment::CellState StepTowards(Filament& filament, Vector3 end);
+        void ComputeTargetPositions();
+        float FilamentSigma(float birthTime) const;
+        Environment::CellState StepTowards(Vector3& position, Vector3 end, StepStatistics& cost);
         void SaveResults();
+        void WriteFilamentArray(BufferWriter& writer, std::vector<Filament>& filamentArray);
+        void WriteFilamentsDelta(BufferWriter& writer);
 
         // Only used in preCalculateConcentrations mode
         void UpdateConcentrations();
@@ -63,25 +112,58 @@ namespace gaden
     private:
         Parameters parameters;
 
-        // ping-pong configuration to avoid deleting filaments from the middle of the vector
-        // for any given iteration, only one of the vectors actually contains the filaments (pointed at by activeFilaments)
-        // when iterating over all the filaments to update their positions, we copy all the ones that survive to the other vector
+        // ping-pong configuration to avoid deleting filaments from the middle of the arrays
+        // for any given iteration, only one of the stores actually contains the filaments (pointed at by activeFilaments)
+        // when iterating over all the filaments to update their positions, we copy all the ones that survive to the other store
         // then, we clear activeFilaments and we swap the pointers
-        std::vector<Filament> filaments1;
-        std::vector<Filament> filaments2;
-        std::vector<Filament>* activeFilaments;
-        std::vector<Filament>* auxFilamentsVector;
+        FilamentStore filaments1;
+        FilamentStore filaments2;
+        FilamentStore* activeFilaments;
+        FilamentStore* auxFilamentsVector;
+
+        // positions each filament would reach this step if there were no obstacles. Written by the vectorized kernel, consumed by the collision checks
+        SegmentedVector<float> targetX;
+        SegmentedVector<float> targetY;
+        SegmentedVector<float> targetZ;
+        SegmentedVector<uint8_t> clearMove; // the whole move happens inside the clearance radius of the starting cell, no need to check for collisions
+        // scratch inputs of the kernel, per filament: N(0,1) noise for this step, and the wind and clearance of its cell, gathered from the environment
+        SegmentedVector<float> noiseX;
+        SegmentedVector<float> noiseY;
+        SegmentedVector<float> noiseZ;
+        SegmentedVector<float> windX;
+        SegmentedVector<float> windY;
+        SegmentedVector<float> windZ;
+        SegmentedVector<uint8_t> cellClearance;
+
+        // AoS copy of the filaments for GetFilaments(). Only rebuilt when someone asks for it after the filaments have moved
+        mutable std::vector<Filament> filamentsView;
+        mutable bool filamentsViewDirty = true;
+        mutable std::mutex filamentsViewMutex;
 
         float currentTime = 0.0;
+        float filamentsTime = 0.0; // time at which the current filament state is valid. Runs one deltaTime ahead of currentTime from MoveFilaments to the end of AdvanceTimestep
         size_t currentIteration = 0;
+        StepStatistics stepStatistics;
 
         float lastSaveTime = -FLT_MAX;
         float lastWindUpdateTime = 0.0;
 
         float releaseAccumulator = 0.0; // to handle non-integer values of numFilaments_iteration over multiple iterations
+        uint32_t nextFilamentID = 0;
+
+        float maxFilamentAge;
+        float retirementSigmaSqr;  //[cm²] sigma² at which the concentration at the center of a filament of weight 1 drops below filamentMinPPMcenter. Scaled by weight^(2/3) for the rest
+        size_t numRetiredFilaments = 0;
+        float buoyancyCoefficient; // terminal buoyancy velocity of a filament is buoyancyCoefficient/sigma³. Depends only on the gas and the simulation constants
 
         size_t last_saved_step = 0;
-        std::vector<uint8_t> rawBuffer;
-        std::vector<uint8_t> compressedBuffer;
+        size_t lastKeyframe = 0;
+        FilamentFrame savedFrame;   // previous snapshot, which the next delta is relative to. Only if saveKeyframeInterval > 0
+        FilamentFrame unsavedFrame; // scratch for the snapshot being written
+        std::unique_ptr<ResultsWriter> resultsWriter; // only exists if saveResults
+
+        // Only used in preCalculateConcentrations mode. Indices of the filaments that overlap each tile of the concentration grid, see UpdateConcentrations
+        std::vector<uint32_t> tileStart;
+        std::vector<uint32_t> tileFilaments;
     };
 } // namespace gaden
\ No newline at end of file
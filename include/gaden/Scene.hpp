@@ -32,6 +32,12 @@ namespace gaden
         std::map<GasType, float> SampleConcentrations(Vector3 const& point) const;
         std::vector<GasType> GetGasTypes();
 
+        // each gas that is in the scene once, in the order of the results of the batched SampleConcentrations
+        std::vector<GasType> GetDistinctGasTypes() const;
+        // concentration of every gas at every point, added up over the simulations of the same gas
+        // results[g * points.size() + i] is the concentration of GetDistinctGasTypes()[g] at points[i], so 'results' must have points.size() * GetDistinctGasTypes().size() elements
+        void SampleConcentrations(std::span<const Vector3> points, std::span<float> results) const;
+
         std::vector<std::shared_ptr<Simulation>> const& GetSimulations();
         std::vector<gaden::Color> GetColors();
 
@@ -2,6 +2,11 @@
 #include "gaden/EnvironmentConfiguration.hpp"
 #include "gaden/datatypes/Filament.hpp"
 #include "gaden/datatypes/SimulationMetadata.hpp"
+#include "gaden/internal/FilamentGrid.hpp"
+#include <atomic>
+#include <mutex>
+#include <span>
+#include <vector>
 
 namespace gaden
 {
@@ -12,15 +17,30 @@ namespace gaden
     public:
         Simulation(const EnvironmentConfiguration& configuration)
             : config(configuration)
-        {}
+        {
+            // used by the line of sight checks. Environments that are read from a file already have it
+            if (config.environment.clearance.size() != config.environment.numCells())
+                config.environment.ComputeClearance();
+        }
 
         virtual void AdvanceTimestep() = 0;
         float SampleConcentration(const Vector3& point) const;
+        // same as calling SampleConcentration for each point, but evaluated in parallel, and sharing the lookup of nearby filaments between points that are close together
+        // 'results' must have one element per point
+        void SampleConcentrations(std::span<const Vector3> points, std::span<float> results) const;
 
         virtual Vector3 SampleWind(const Vector3i& indices) const;
         Vector3 SampleWind(const Vector3& point) const;
 
-        virtual const std::vector<Filament>& GetFilaments() const = 0;
+        // the span is only valid until the next call to AdvanceTimestep()
+        virtual std::span<const Filament> GetFilaments() const = 0;
+
+        // for code written against the old interface, which returned a std::vector. Makes a copy, so prefer GetFilaments()
+        std::vector<Filament> GetFilamentsVector() const
+        {
+            std::span<const Filament> filaments = GetFilaments();
+            return std::vector<Filament>(filaments.begin(), filaments.end());
+        }
 
     protected:
         bool CheckLineOfSight(Vector3 start, Vector3 end) const;
@@ -29,6 +49,10 @@ namespace gaden
 
         float ConcentrationAtCenter(Filament const& filament) const;
 
+        // must be called whenever the result of GetFilaments() changes. The grid is rebuilt the next time it is needed
+        void InvalidateFilamentGrid() { filamentGridDirty = true; }
+        const FilamentGrid& GetFilamentGrid() const;
+
     public:
         EnvironmentConfiguration config;
         SimulationMetadata simulationMetadata;
@@ -37,5 +61,11 @@ namespace gaden
 
     protected:
         std::optional<std::vector<float>> concentrations; // only valid if params.preCalculateConcentrations
+
+    private:
+        // spatial index of GetFilaments() for the concentration queries. Built on demand, so it costs nothing in steps where nobody samples the gas
+        mutable FilamentGrid filamentGrid;
+        mutable std::atomic<bool> filamentGridDirty = true;
+        mutable std::mutex filamentGridMutex;
     };
 } // namespace gaden
\ No newline at end of file
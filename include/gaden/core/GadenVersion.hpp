@@ -3,5 +3,5 @@
 namespace gaden
 {
     constexpr int versionMajor = 3;
-    constexpr int versionMinor = 0;
+    constexpr int versionMinor = 4;
 }
\ No newline at end of file
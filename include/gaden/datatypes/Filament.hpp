@@ -1,6 +1,7 @@
 #pragma once
 
 #include "gaden/core/Vectors.hpp"
+#include <cstdint>
 
 namespace gaden
 {
@@ -16,6 +17,9 @@ namespace gaden
 
         Vector3 position;
         float sigma;
+        float weight = 1; // amount of gas in the filament, in multiples of SimulationMetadata::Constants::totalMolesInFilament. Only different from 1 for filaments that were produced by merging others
         bool active = true;
+        uint8_t padding[3] = {}; // explicit, so the bytes that go into the results files are always the same (and compress well)
     };
+    static_assert(sizeof(Filament) == 24);
 } // namespace gaden
\ No newline at end of file
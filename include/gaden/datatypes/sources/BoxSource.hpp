@@ -8,11 +8,11 @@ namespace gaden
     class BoxSource : public GasSource
     {
     public:
-        Vector3 Emit() const override
+        Vector3 Emit(CounterRNG& rng) const override
         {
-            Vector3 offset(uniformRandom(-size.x * 0.5, size.x * 0.5),
-                           uniformRandom(-size.y * 0.5, size.y * 0.5),
-                           uniformRandom(-size.z * 0.5, size.z * 0.5));
+            Vector3 offset(rng.Uniform(-size.x * 0.5, size.x * 0.5),
+                           rng.Uniform(-size.y * 0.5, size.y * 0.5),
+                           rng.Uniform(-size.z * 0.5, size.z * 0.5));
 
             return sourcePosition + offset;
         }
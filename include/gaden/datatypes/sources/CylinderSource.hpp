@@ -7,17 +7,17 @@ namespace gaden
     class CylinderSource : public GasSource
     {
     public:
-        Vector3 Emit() const override
+        Vector3 Emit(CounterRNG& rng) const override
         {
             Vector2 pointInCircle;
 
             do
             {
-                pointInCircle = {uniformRandom(-radius, radius),
-                                 uniformRandom(-radius, radius)};
+                pointInCircle = {rng.Uniform(-radius, radius),
+                                 rng.Uniform(-radius, radius)};
             } while (vmath::sqrlength(pointInCircle) > radius * radius);
 
-            float l = uniformRandom(-height * 0.5, height * 0.5);
+            float l = rng.Uniform(-height * 0.5, height * 0.5);
 
             return sourcePosition + Vector3(pointInCircle.x, pointInCircle.y, l);
         }
@@ -2,6 +2,7 @@
 #include "gaden/core/Vectors.hpp"
 #include "gaden/datatypes/GasTypes.hpp"
 #include "gaden/internal/BufferUtils.hpp"
+#include "gaden/internal/Random.hpp"
 
 // we need to do a forward declaration because gaden does not export yaml-cpp as a dependency
 // (to avoid version conflicts on ros nodes that use the yaml-cpp vendor package)
@@ -29,7 +30,8 @@ namespace gaden
              "cylinder"});
 
     public:
-        virtual Vector3 Emit() const = 0;
+        // the random numbers come from the generator, so the emitted positions are reproducible
+        virtual Vector3 Emit(CounterRNG& rng) const = 0;
         virtual const char* Type() const = 0;
 
         Vector3 sourcePosition;
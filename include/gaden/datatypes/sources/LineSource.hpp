@@ -8,9 +8,9 @@ namespace gaden
     class LineSource : public GasSource
     {
     public:
-        Vector3 Emit() const override
+        Vector3 Emit(CounterRNG& rng) const override
         {
-            float t = uniformRandom(0, 1);
+            float t = rng.Uniform(0, 1);
             return vmath::lerp(sourcePosition, lineEnd, t);
         }
         const char* Type() const override {return "line";} 
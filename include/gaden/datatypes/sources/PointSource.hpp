@@ -7,7 +7,7 @@ namespace gaden
     class PointSource : public GasSource
     {
     public:
-        virtual Vector3 Emit() const override
+        virtual Vector3 Emit(CounterRNG&) const override
         {
             return sourcePosition;
         }  
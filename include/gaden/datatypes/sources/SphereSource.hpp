@@ -7,15 +7,15 @@ namespace gaden
     class SphereSource : public GasSource
     {
     public:
-        virtual Vector3 Emit() const override
+        virtual Vector3 Emit(CounterRNG& rng) const override
         {
             // rejection sampling
             // looks funky, but it is generally faster than generating the points in spherical coordinates and converting to cartesian
             while (true)
             {
-                Vector3 offset(uniformRandom(-radius, radius),
-                               uniformRandom(-radius, radius),
-                               uniformRandom(-radius, radius));
+                Vector3 offset(rng.Uniform(-radius, radius),
+                               rng.Uniform(-radius, radius),
+                               rng.Uniform(-radius, radius));
                 float sqrDistance = vmath::sqrlength(offset);
                 if (sqrDistance <= radius * radius)
                     return sourcePosition + offset;
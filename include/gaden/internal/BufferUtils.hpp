@@ -1,22 +1,22 @@
 #pragma once
+#include <cstdint>
+#include <stdexcept>
 #include <string>
 #include <string.h>
 #include <vector>
 
 namespace gaden
 {
-    // maximum size that the data can take pre-compression. We fix this here so that the PlaybackSimulation can know the upper bound of the uncompressed size and allocate its buffer accordingly
-    inline constexpr size_t maxBufferSize = 5e6;
-
+    // appends to a byte vector, which grows as needed
+    // the vector keeps its capacity between uses, so a writer that serializes into the same vector every time only allocates until it reaches the largest size
     class BufferWriter
     {
     public:
         BufferWriter() = delete;
-        BufferWriter(char* _start, size_t _size)
+        BufferWriter(std::vector<uint8_t>& _buffer)
+            : buffer(_buffer)
         {
-            start = _start;
-            current = start;
-            end = start + _size;
+            buffer.clear();
         }
 
         template <typename T>
@@ -25,8 +25,7 @@ namespace gaden
             Write(address, sizeof(T));
         }
 
-        template <>
-        void Write<std::string>(std::string* address)
+        void Write(std::string* address)
         {
             size_t size = address->length();
             Write(&size);
@@ -44,26 +43,25 @@ namespace gaden
         template <typename T>
         void Write(T* address, size_t size)
         {
-            memcpy(current, address, size);
-            current += size;
+            const uint8_t* bytes = (const uint8_t*)address;
+            buffer.insert(buffer.end(), bytes, bytes + size);
         }
 
         size_t currentOffset()
         {
-            return current - start;
+            return buffer.size();
         }
 
     private:
-        char* start;
-        char* current;
-        char* end;
+        std::vector<uint8_t>& buffer;
     };
 
+    // reads from a fixed buffer. Throws std::out_of_range if asked to read past the end (truncated or corrupted data)
     class BufferReader
     {
     public:
         BufferReader() = delete;
-        BufferReader(char* _start, size_t _size)
+        BufferReader(const char* _start, size_t _size)
         {
             start = _start;
             current = start;
@@ -79,15 +77,16 @@ namespace gaden
         template <typename T>
         void Read(T* address, size_t size)
         {
+            CheckAvailable(size);
             memcpy(address, current, size);
             current += size;
         }
 
-        template <>
-        void Read<std::string>(std::string* address)
+        void Read(std::string* address)
         {
             size_t size;
             Read(&size);
+            CheckAvailable(size);
             address->resize(size);
             Read(address->data(), size);
         }
@@ -97,10 +96,21 @@ namespace gaden
         {
             size_t size;
             Read(&size);
+            CheckAvailableElements<T>(size);
             address->resize(size);
             Read(address->data(), size * sizeof(T));
         }
 
+        // skips over 'count' elements and returns a pointer to them in the buffer, instead of copying them out
+        template <typename T>
+        const T* View(size_t count)
+        {
+            CheckAvailableElements<T>(count);
+            const T* view = (const T*)current;
+            current += count * sizeof(T);
+            return view;
+        }
+
         size_t currentOffset()
         {
             return current - start;
@@ -108,6 +118,7 @@ namespace gaden
 
         void AdvancePointer(size_t offset)
         {
+            CheckAvailable(offset);
             current += offset;
         }
 
@@ -117,8 +128,22 @@ namespace gaden
         }
 
     private:
-        char* start;
-        char* current;
-        char* end;
+        void CheckAvailable(size_t size)
+        {
+            if (size > size_t(end - current))
+                throw std::out_of_range("Tried to read past the end of the buffer");
+        }
+
+        // same, for 'count' elements of type T. Does not multiply, so a corrupted count cannot overflow into a small size
+        template <typename T>
+        void CheckAvailableElements(size_t count)
+        {
+            if (count > size_t(end - current) / sizeof(T))
+                throw std::out_of_range("Tried to read past the end of the buffer");
+        }
+
+        const char* start;
+        const char* current;
+        const char* end;
     };
 } // namespace gaden
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gaden
+{
+    struct DecodedSnapshot
+    {
+        std::vector<uint8_t> buffer;
+        size_t size = 0; // bytes of the buffer that hold the snapshot
+    };
+
+    // Process-wide cache of decompressed result snapshots, keyed by (results directory, iteration)
+    // all the PlaybackSimulations share it, so a looped simulation only decompresses each iteration once, and two simulations that play the same results decompress them once between them
+    // it is bounded by a memory budget, and evicts the least recently used snapshots when it goes over it. Snapshots that are still held by someone stay alive until they are released
+    // it also keeps a few scratch buffers to decompress into, which are taken from (and returned to) the snapshots it evicts, so it stops allocating once it is warm
+    // all the functions are thread-safe
+    class DecodedSnapshotCache
+    {
+    public:
+        using Handle = std::shared_ptr<const DecodedSnapshot>;
+
+        static DecodedSnapshotCache& Get();
+
+        //[bytes] 0 -> nothing is cached, only the scratch buffers are shared
+        void SetMemoryBudget(size_t bytes);
+        size_t GetMemoryBudget();
+        size_t BytesHeld(); // by the cached snapshots, not counting the scratch buffers
+
+        // snapshots are identified by this key of their results directory, which is the same for all the paths that lead to it. Compute it once, it touches the filesystem
+        // it changes every time the directory is invalidated, so the snapshots of results that have been written over are never served to a playback of the new ones
+        std::string DirectoryKey(const std::filesystem::path& directory);
+
+        // the results in the directory are about to be written again (e.g. a new simulation saves to it). Drops its snapshots, and gives it a new key
+        // playbacks that were already open keep their old key, so anything they still insert cannot be found with the new one
+        void InvalidateDirectory(const std::filesystem::path& directory);
+
+        Handle Find(const std::string& directoryKey, size_t iteration); // nullptr if it is not cached
+        bool Contains(const std::string& directoryKey, size_t iteration);
+
+        // takes ownership of the decoded buffer. If another thread cached the same iteration in the meantime, that one is returned instead, and the buffer is recycled
+        Handle Insert(const std::string& directoryKey, size_t iteration, std::vector<uint8_t>&& buffer, size_t size);
+
+        // wraps a decoded buffer in a handle without caching it (e.g. the instance opted out of the cache)
+        Handle Wrap(std::vector<uint8_t>&& buffer, size_t size);
+
+        // a buffer to decompress into (empty if there is none to reuse). Give it back with ReturnScratchBuffer if it does not end up in the cache
+        std::vector<uint8_t> TakeScratchBuffer();
+        void ReturnScratchBuffer(std::vector<uint8_t>&& buffer);
+
+        // drops a handle. If it was the last reference to a snapshot that is no longer cached, its buffer goes back to the scratch buffers
+        void Release(Handle&& handle);
+
+        void Clear();
+
+    private:
+        using Key = std::pair<std::string, size_t>;
+        struct Entry
+        {
+            Key key;
+            std::shared_ptr<DecodedSnapshot> snapshot;
+        };
+
+        static std::string CanonicalPath(const std::filesystem::path& directory);
+        void Remove(std::list<Entry>::iterator entry); // requires the lock
+        void EvictOverBudget();                       // requires the lock
+        void RecycleBuffer(std::vector<uint8_t>&& buffer); // requires the lock
+
+    private:
+        static constexpr size_t maxScratchBuffers = 8;
+
+        std::mutex mutex;
+        size_t memoryBudget = size_t(256) << 20;
+        size_t bytesHeld = 0;
+        size_t lastSnapshotBytes = 0; // to guess whether the next one is going to fit
+        std::list<Entry> entries; // least recently used first
+        std::map<Key, std::list<Entry>::iterator> lookup;
+        std::vector<std::vector<uint8_t>> scratchBuffers;
+        std::map<std::string, size_t> directoryGenerations; // by canonical path. Missing -> 0
+    };
+} // namespace gaden
@@ -0,0 +1,32 @@
+#pragma once
+#include "gaden/datatypes/Filament.hpp"
+#include "gaden/internal/BufferUtils.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace gaden
+{
+    // Temporal encoding of the filament snapshots in the results
+    // consecutive snapshots mostly contain the same filaments, each having moved and grown a little. So, between keyframes (full snapshots),
+    // only the difference with the previous snapshot is stored:
+    //  - which of the previous filaments are still there (one bit each)
+    //  - for those, the XOR of the bits of every field with its previous value. Fields that barely changed have most of their high bits at zero, and
+    //    the values are stored as byte planes (all the first bytes, then all the second bytes...) so the compression codec can make the most of it
+    //  - the new filaments, in full
+    // it is lossless: playback gets exactly the same values it would get from full snapshots
+    struct FilamentFrame
+    {
+        std::vector<Filament> filaments;
+        std::vector<uint32_t> ids; // stable id of each filament (see FilamentStore::id). Must be sorted, which is the case for the filaments of a RunningSimulation
+
+        size_t size() const { return filaments.size(); }
+    };
+
+    bool SortedByID(const std::vector<uint32_t>& ids);
+
+    void WriteFilamentDelta(BufferWriter& writer, const FilamentFrame& previous, const FilamentFrame& current);
+
+    // 'current' must not be the same object as 'previous'
+    // throws std::out_of_range if the data is corrupted, or does not correspond to the 'previous' frame
+    void ReadFilamentDelta(BufferReader& reader, const FilamentFrame& previous, FilamentFrame& current);
+} // namespace gaden
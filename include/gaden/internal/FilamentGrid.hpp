@@ -0,0 +1,79 @@
+#pragma once
+#include "gaden/core/Vectors.hpp"
+#include "gaden/datatypes/Filament.hpp"
+#include <algorithm>
+#include <cmath>
+#include <span>
+#include <vector>
+
+namespace gaden
+{
+    // Uniform grid over the filament centers, to find the filaments that can contribute to the concentration at a point without going over all of them
+    // the cells are (at least) as large as the biggest cutoff radius of any filament, so the only filaments that can reach a point are in its cell or the 26 around it
+    // the filaments are copied in cell order, so the ones that are visited together are also next to each other in memory
+    class FilamentGrid
+    {
+    public:
+        // a filament does not contribute to the concentration past this distance [m] (3 sigma)
+        static float CutoffRadius(const Filament& filament) { return filament.sigma * 3 / 100.f; }
+
+        // filaments outside of the bounds are put in the closest cell, which is still correct for queries that are inside of them
+        void Build(std::span<const Filament> filaments, const Vector3& minCoord, const Vector3& maxCoord);
+        void Clear();
+
+        // calls function(const Filament&) for every filament that is close enough to the point that it might be within its cutoff radius
+        template <typename Function>
+        void ForEachNear(const Vector3& point, Function&& function) const
+        {
+            ForEachRangeNear(point, [&](const Filament* begin, const Filament* end) {
+                for (const Filament* filament = begin; filament != end; filament++)
+                    function(*filament);
+            });
+        }
+
+        // same, but calls function(const Filament* begin, const Filament* end) once for each consecutive range of filaments
+        // all the points in the same cell (see CellIndex) get the same ranges
+        template <typename Function>
+        void ForEachRangeNear(const Vector3& point, Function&& function) const
+        {
+            if (sortedFilaments.empty())
+                return;
+
+            Vector3i cell = CellOf(point);
+            int xMin = std::max(cell.x - 1, 0), xMax = std::min(cell.x + 1, dimensions.x - 1);
+            for (int z = std::max(cell.z - 1, 0); z <= std::min(cell.z + 1, dimensions.z - 1); z++)
+            {
+                for (int y = std::max(cell.y - 1, 0); y <= std::min(cell.y + 1, dimensions.y - 1); y++)
+                {
+                    // the cells of a row are consecutive, so their filaments are a single range
+                    size_t rowStart = Index({0, y, z});
+                    uint32_t begin = cellStart[rowStart + xMin], end = cellStart[rowStart + xMax + 1];
+                    if (begin != end)
+                        function(sortedFilaments.data() + begin, sortedFilaments.data() + end);
+                }
+            }
+        }
+
+        size_t CellIndex(const Vector3& point) const { return sortedFilaments.empty() ? 0 : Index(CellOf(point)); }
+
+    private:
+        Vector3i CellOf(const Vector3& point) const
+        {
+            Vector3i cell;
+            for (int i = 0; i < 3; i++)
+                cell[i] = std::clamp(int(std::floor((point[i] - origin[i]) / cellSize)), 0, dimensions[i] - 1);
+            return cell;
+        }
+        size_t Index(const Vector3i& cell) const { return cell.x + size_t(dimensions.x) * (cell.y + size_t(dimensions.y) * cell.z); }
+
+    private:
+        static constexpr size_t maxCellsPerFilament = 2; // the grid gets coarser rather than having many more (empty) cells than filaments
+
+        Vector3 origin;
+        float cellSize = 1;
+        Vector3i dimensions{0, 0, 0};
+        std::vector<uint32_t> cellStart; // filaments of cell i are sortedFilaments[cellStart[i], cellStart[i+1])
+        std::vector<Filament> sortedFilaments;
+        std::vector<uint32_t> filamentCells; // scratch, kept to avoid allocating on every build
+    };
+} // namespace gaden
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace gaden
+{
+    // Vectorized per-step kernels of RunningSimulation, over one chunk of the SoA filament arrays (see FilamentStore)
+    // they live in their own translation unit, which is compiled without errno for the math functions, and on x86-64 each one is built for AVX-512, AVX2 and baseline SSE2
+    // the best version the CPU supports is picked at load time, so the same binary runs everywhere without GADEN_NATIVE_ARCH
+    // the three versions give bit-identical results (no FMA contraction in this file), so the results of a simulation do not depend on the machine that ran it
+
+    // N(0,1) noise for 'count' filaments on a given step. Same values as CounterGaussian(seed, id, step, RandomStream::FilamentNoise)
+    void GenerateFilamentNoise(size_t count, const uint32_t* ids, uint64_t seed, uint64_t step, float* noiseX, float* noiseY, float* noiseZ);
+
+    struct FilamentMoveInput
+    {
+        const float* x;
+        const float* y;
+        const float* z;
+        const float* birthTime;
+        const float* weight;
+        const float* windX; //[m/s] wind plus local disturbances at the cell of each filament, gathered beforehand
+        const float* windY;
+        const float* windZ;
+        const float* noiseX; // see GenerateFilamentNoise
+        const float* noiseY;
+        const float* noiseZ;
+        const uint8_t* clearance; // of the cell of each filament, see Environment::clearance
+    };
+
+    struct FilamentMoveOutput
+    {
+        float* targetX;
+        float* targetY;
+        float* targetZ;
+        uint8_t* clearMove; // the whole move stays within the clearance of the starting cell
+    };
+
+    struct FilamentMoveConstants
+    {
+        float deltaTime;       //[s]
+        float time;            //[s] of the filaments, to get their age from birthTime
+        float initialSigmaSqr; //[cm²]
+        float growthGamma;     //[cm²/s]
+        float buoyancy;
+        float noiseStd;
+        float cellSize; //[m]
+    };
+
+    // where each filament would end up this step if there were no obstacles: advection, buoyancy and noise
+    void ComputeFilamentTargets(size_t count, const FilamentMoveInput& input, const FilamentMoveOutput& output, const FilamentMoveConstants& constants);
+} // namespace gaden
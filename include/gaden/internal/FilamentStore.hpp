@@ -0,0 +1,102 @@
+#pragma once
+#include "gaden/datatypes/Filament.hpp"
+#include "gaden/internal/SegmentedVector.hpp"
+#include <cstdint>
+
+namespace gaden
+{
+    // Structure-of-arrays storage for the filaments of a RunningSimulation
+    // every attribute lives in its own array, so the per-step update loops can be vectorized
+    // the arrays grow in chunks (see SegmentedVector) that are shared index-wise: chunk c of every attribute covers the same filaments
+    // the AoS representation (gaden::Filament) is still used for everything that leaves the simulation (GetFilaments, results files)
+    struct FilamentStore
+    {
+        SegmentedVector<float> x;
+        SegmentedVector<float> y;
+        SegmentedVector<float> z;
+        SegmentedVector<float> birthTime; // sigma is not stored, it is a closed-form function of the age of the filament (see RunningSimulation::FilamentSigma)
+                                          // merges move it back so that it gives the sigma of the merged filament, so it is not the actual age
+        SegmentedVector<float> emissionTime; // when the gas of the filament was released (for merged filaments, the average of the ones that went into it, weighted by their amount of gas). Used for filamentMaxAge
+        SegmentedVector<float> weight;    // see Filament::weight
+        SegmentedVector<uint8_t> active;
+        SegmentedVector<uint32_t> id; // unique within a simulation, assigned in emission order. Used to key the random numbers of each filament
+
+        static constexpr size_t chunkSize = SegmentedVector<float>::chunkSize;
+
+        size_t size() const { return x.size(); }
+        size_t capacity() const { return x.capacity(); }
+        size_t numChunks() const { return x.numChunks(); }
+        size_t chunkLength(size_t chunk) const { return x.chunkLength(chunk); }
+
+        // bytes
+        size_t memoryUsage() const
+        {
+            return x.memoryUsage() + y.memoryUsage() + z.memoryUsage() + birthTime.memoryUsage() + emissionTime.memoryUsage() + weight.memoryUsage() + active.memoryUsage() + id.memoryUsage();
+        }
+
+        void resize(size_t n)
+        {
+            x.resize(n);
+            y.resize(n);
+            z.resize(n);
+            birthTime.resize(n);
+            emissionTime.resize(n);
+            weight.resize(n);
+            active.resize(n);
+            id.resize(n);
+        }
+
+        void clear()
+        {
+            x.clear();
+            y.clear();
+            z.clear();
+            birthTime.clear();
+            emissionTime.clear();
+            weight.clear();
+            active.clear();
+            id.clear();
+        }
+
+        void push_back(const Vector3& filamentPosition, float filamentBirthTime, uint32_t filamentID)
+        {
+            x.push_back(filamentPosition.x);
+            y.push_back(filamentPosition.y);
+            z.push_back(filamentPosition.z);
+            birthTime.push_back(filamentBirthTime);
+            emissionTime.push_back(filamentBirthTime);
+            weight.push_back(1);
+            active.push_back(true);
+            id.push_back(filamentID);
+        }
+
+        Vector3 position(size_t i) const { return {x[i], y[i], z[i]}; }
+
+        void setPosition(size_t i, const Vector3& p)
+        {
+            x[i] = p.x;
+            y[i] = p.y;
+            z[i] = p.z;
+        }
+
+        Filament get(size_t i, float sigma) const
+        {
+            Filament filament(x[i], y[i], z[i], sigma);
+            filament.weight = weight[i];
+            filament.active = active[i];
+            return filament;
+        }
+
+        void copyFrom(const FilamentStore& other, size_t from, size_t to)
+        {
+            x[to] = other.x[from];
+            y[to] = other.y[from];
+            z[to] = other.z[from];
+            birthTime[to] = other.birthTime[from];
+            emissionTime[to] = other.emissionTime[from];
+            weight[to] = other.weight[from];
+            active[to] = other.active[from];
+            id[to] = other.id[from];
+        }
+    };
+} // namespace gaden
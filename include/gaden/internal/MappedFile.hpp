@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace gaden
+{
+    // read-only memory mapping of a whole file
+    // lets the results be read straight from the page cache, instead of being copied into a buffer first
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // maps the current contents of the file. Anything that was mapped before is released (and pointers into it become invalid)
+        bool Open(const std::filesystem::path& path);
+        void Close();
+
+        bool IsOpen() const { return isOpen; }
+        const uint8_t* data() const { return mappedData; }
+        size_t size() const { return mappedSize; }
+
+    private:
+        const uint8_t* mappedData = nullptr;
+        size_t mappedSize = 0;
+        bool isOpen = false;
+    };
+} // namespace gaden
@@ -45,28 +45,4 @@ namespace gaden
         return std::abs(x - y) < epsilon;
     }
 
-    // holds a long list of N(0,1) values, and returns them one at a time, scaled as requested.
-    // obviously not as good as generating them on the fly, but it's not like we are doing cryptography here
-    template <int Size>
-    class PrecalculatedGaussian
-    {
-    public:
-        PrecalculatedGaussian()
-        {
-            m_index = uniformRandom(0, Size);
-            for (size_t i = 0; i < Size; i++)
-                m_precalculatedTable[i] = GaussianRandom(0, 1);
-        }
-
-        float nextValue(float mean, float stdev)
-        {
-            m_index = (m_index + 1) % Size;
-            return mean + stdev * m_precalculatedTable[m_index];
-        }
-
-    private:
-        uint16_t m_index;
-        std::array<float, Size> m_precalculatedTable;
-    };
-
 } // namespace gaden
\ No newline at end of file
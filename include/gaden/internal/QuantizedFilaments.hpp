@@ -0,0 +1,22 @@
+#pragma once
+#include "gaden/datatypes/Filament.hpp"
+#include "gaden/internal/BufferUtils.hpp"
+#include <vector>
+
+namespace gaden
+{
+    // Lossy, compact encoding of the filaments in the results: 8 bytes per filament instead of sizeof(Filament) (24)
+    //  - positions are quantized to 16 bits per axis within the bounds of the environment. The error is at most half a step, (maxCoord-minCoord)/131070,
+    //    e.g. 0.15mm for an environment that is 20m across. Filaments outside of the bounds are clamped to them
+    //  - sigma is quantized to 16 bits in log space, between quantizedSigmaMin and quantizedSigmaMax. The relative error is at most 0.015%
+    //    (0.045% in the concentration at the center of the filament, which goes with sigma³)
+    //  - the weight is stored as a float, and only if some filament does not have the default weight of 1 (merged filaments, see RunningSimulation::maxActiveFilaments)
+    //  - the active flag is dropped, every filament in the results is active
+    inline constexpr float quantizedSigmaMin = 1e-3; //[cm]
+    inline constexpr float quantizedSigmaMax = 1e5;  //[cm]
+
+    void WriteQuantizedFilaments(BufferWriter& writer, const std::vector<Filament>& filaments, const Vector3& minCoord, const Vector3& maxCoord);
+
+    // throws std::out_of_range if the data is truncated or corrupted
+    void ReadQuantizedFilaments(BufferReader& reader, std::vector<Filament>& filaments);
+} // namespace gaden
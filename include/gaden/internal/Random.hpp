@@ -0,0 +1,181 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+namespace gaden
+{
+    // Philox4x32-10 counter-based generator (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC'11)
+    // the output is a pure function of (key, counter), so there is no state to share between threads:
+    // anything that can be uniquely labeled (e.g. a filament on a given step) can draw its own random numbers, and the result does not depend on the thread that does it
+    namespace philox
+    {
+        using Counter = std::array<uint32_t, 4>;
+        using Key = std::array<uint32_t, 2>;
+
+        // the rounds on plain scalars rather than arrays, so that loops that call this can keep every value in a vector register
+        inline void Generate(uint32_t& c0, uint32_t& c1, uint32_t& c2, uint32_t& c3, uint32_t k0, uint32_t k1)
+        {
+            constexpr uint32_t M0 = 0xD2511F53;
+            constexpr uint32_t M1 = 0xCD9E8D57;
+            constexpr uint32_t W0 = 0x9E3779B9;
+            constexpr uint32_t W1 = 0xBB67AE85;
+
+            for (int round = 0; round < 10; round++)
+            {
+                uint64_t product0 = static_cast<uint64_t>(M0) * c0;
+                uint64_t product1 = static_cast<uint64_t>(M1) * c2;
+                c0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+                c1 = static_cast<uint32_t>(product1);
+                c2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+                c3 = static_cast<uint32_t>(product0);
+                k0 += W0;
+                k1 += W1;
+            }
+        }
+
+        inline Counter Generate(Counter counter, Key key)
+        {
+            Generate(counter[0], counter[1], counter[2], counter[3], key[0], key[1]);
+            return counter;
+        }
+
+        inline Key KeyFromSeed(uint64_t seed)
+        {
+            return {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+        }
+
+        // [0, 1)
+        inline float ToUniform(uint32_t value)
+        {
+            return static_cast<int32_t>(value >> 8) * (1.f / 16777216.f); // through int32, which converts to float with a single instruction
+        }
+
+        // (0, 1], safe to take the log of
+        inline float ToUniformNonZero(uint32_t value)
+        {
+            return static_cast<int32_t>((value >> 8) + 1) * (1.f / 16777216.f);
+        }
+
+        // log and sin/cos for the Box-Muller transform below, with no branches or library calls, so that the loops that generate normals can be vectorized
+        // (the libm versions are calls, and set errno). Accurate to a few ulp over the ranges that ToNormals uses
+
+        // x must be positive and normal, as the output of ToUniformNonZero is
+        inline float Log(float x)
+        {
+            // split x into 2^exponent * mantissa, with the mantissa in [sqrt(1/2), sqrt(2)), where the series below converges fast
+            // done on the bits: offsetting them by the mantissa of sqrt(1/2) carries into the exponent exactly when the mantissa is >= sqrt(2) (no branches, unlike a comparison)
+            constexpr uint32_t sqrtHalfBits = 0x3F3504F3;
+            uint32_t shifted = std::bit_cast<uint32_t>(x) + (0x3F800000 - sqrtHalfBits);
+            int exponent = int(shifted >> 23) - 127;
+            float mantissa = std::bit_cast<float>((shifted & 0x007FFFFF) + sqrtHalfBits);
+
+            // log(m) = 2 * atanh((m-1)/(m+1)) = 2 * (t + t³/3 + t⁵/5 + ...), |t| < 0.18
+            float t = (mantissa - 1) / (mantissa + 1);
+            float t2 = t * t;
+            float series = t * (2 + t2 * (2.f / 3 + t2 * (2.f / 5 + t2 * (2.f / 7 + t2 * (2.f / 9)))));
+            return series + exponent * 0.693147181f;
+        }
+
+        // sin and cos of 2*pi*turns, for turns in [0, 1)
+        inline void SinCosTurns(float turns, float& sine, float& cosine)
+        {
+            // closest quarter turn, and the rest as an angle in [-pi/4, pi/4], where the Taylor series are accurate
+            int quadrant = int(turns * 4 + 0.5f);
+            float angle = (turns - quadrant * 0.25f) * float(2 * M_PI);
+            float angle2 = angle * angle;
+            float sinRest = angle * (1 + angle2 * (-1.f / 6 + angle2 * (1.f / 120 + angle2 * (-1.f / 5040 + angle2 * (1.f / 362880)))));
+            float cosRest = 1 + angle2 * (-1.f / 2 + angle2 * (1.f / 24 + angle2 * (-1.f / 720 + angle2 * (1.f / 40320 + angle2 * (-1.f / 3628800)))));
+
+            // rotate by the quarter turns: each one maps (sin, cos) to (cos, -sin)
+            // with masks on the bits rather than selects, which gcc sometimes turns back into branches
+            uint32_t sinBits = std::bit_cast<uint32_t>(sinRest), cosBits = std::bit_cast<uint32_t>(cosRest);
+            uint32_t swap = 0u - uint32_t(quadrant & 1);
+            uint32_t rotatedSin = (cosBits & swap) | (sinBits & ~swap);
+            uint32_t rotatedCos = (sinBits & swap) | (cosBits & ~swap);
+            sine = std::bit_cast<float>(rotatedSin ^ (uint32_t(quadrant & 2) << 30));
+            cosine = std::bit_cast<float>(rotatedCos ^ (uint32_t((quadrant + 1) & 2) << 30));
+        }
+
+        // Box-Muller transform: turns two uniform integers into two independent N(0,1) values
+        inline void BoxMuller(uint32_t radiusBits, uint32_t angleBits, float& normal0, float& normal1)
+        {
+            float radius = std::sqrt(-2.f * Log(ToUniformNonZero(radiusBits)));
+            float sine, cosine;
+            SinCosTurns(ToUniform(angleBits), sine, cosine);
+            normal0 = radius * cosine;
+            normal1 = radius * sine;
+        }
+
+        // only the first of the two values
+        inline float BoxMuller(uint32_t radiusBits, uint32_t angleBits)
+        {
+            float normal0, normal1;
+            BoxMuller(radiusBits, angleBits, normal0, normal1);
+            return normal0;
+        }
+
+        // one Philox block (4 uniform integers) -> 4 independent N(0,1) values
+        inline std::array<float, 4> ToNormals(const Counter& bits)
+        {
+            std::array<float, 4> normals;
+            BoxMuller(bits[0], bits[1], normals[0], normals[1]);
+            BoxMuller(bits[2], bits[3], normals[2], normals[3]);
+            return normals;
+        }
+    } // namespace philox
+
+    // the different uses of the generator get their own counter space, so they never produce correlated values
+    enum class RandomStream : uint32_t
+    {
+        FilamentNoise = 0,
+        Emission = 1,
+    };
+
+    // 4 N(0,1) values for a given (seed, id, step) tuple
+    inline std::array<float, 4> CounterGaussian(uint64_t seed, uint32_t id, uint64_t step, RandomStream stream)
+    {
+        philox::Counter counter = {id, static_cast<uint32_t>(step), static_cast<uint32_t>(step >> 32), static_cast<uint32_t>(stream)};
+        return philox::ToNormals(philox::Generate(counter, philox::KeyFromSeed(seed)));
+    }
+
+    // sequential interface on top of Philox, for code that needs an arbitrary amount of random numbers for a single id (e.g. rejection sampling)
+    // the sequence is fully determined by the constructor arguments
+    class CounterRNG
+    {
+    public:
+        CounterRNG(uint64_t seed, uint32_t id, RandomStream stream)
+            : key(philox::KeyFromSeed(seed)), counter{id, 0, 0, static_cast<uint32_t>(stream)}
+        {}
+
+        float Uniform(float min, float max)
+        {
+            return min + philox::ToUniform(NextBits()) * (max - min);
+        }
+
+        float Gaussian(float mean, float stdDev)
+        {
+            float radius = std::sqrt(-2.f * std::log(philox::ToUniformNonZero(NextBits())));
+            float angle = 2 * M_PI * philox::ToUniform(NextBits());
+            return mean + stdDev * radius * std::cos(angle);
+        }
+
+    private:
+        uint32_t NextBits()
+        {
+            if (used == block.size())
+            {
+                block = philox::Generate(counter, key);
+                counter[1]++;
+                used = 0;
+            }
+            return block[used++];
+        }
+
+        philox::Key key;
+        philox::Counter counter;
+        philox::Counter block;
+        size_t used = 4;
+    };
+} // namespace gaden
@@ -0,0 +1,105 @@
+#pragma once
+#include "gaden/internal/MappedFile.hpp"
+#include "gaden/internal/SnapshotCompression.hpp"
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace gaden
+{
+    // Alternative to the one-file-per-iteration layout of the results: all the snapshots are appended to a single data file,
+    // and a side index file records where each of them is
+    // the index entry of a snapshot is only written once its data is on disk, so a simulation that is interrupted leaves a readable container behind
+    // the one-file-per-iteration layout gets the same index (with offset 0 and the size of each file), so playback can seek without opening the snapshots
+    inline constexpr const char* resultsContainerFileName = "results.gaden";
+    inline constexpr const char* resultsIndexFileName = "results.gaden.index";
+    inline constexpr size_t resultsContainerAlignment = 8; // snapshots start at multiples of this offset in the data file
+
+    // fixed-size record. The layout is the on-disk format of the index, so fields must not be reordered
+    struct ResultsIndexEntry
+    {
+        uint64_t iteration = 0;
+        uint64_t offset = 0; // position of the compressed snapshot in the data file
+        uint64_t size = 0;   // compressed size, snapshot header included
+        uint64_t numFilaments = 0;
+        double time = 0; //[s] simulation time at which the snapshot was taken
+        CompressionCodec codec = CompressionCodec::None;
+        uint8_t padding[7] = {};
+    };
+    static_assert(sizeof(ResultsIndexEntry) == 48);
+
+    class ResultsIndexWriter
+    {
+    public:
+        ResultsIndexWriter(const std::filesystem::path& directory);
+        bool Append(const ResultsIndexEntry& entry);
+
+    private:
+        std::ofstream indexFile;
+    };
+
+    // the index as seen by a reader. Entries are sorted by iteration (and therefore by time)
+    class ResultsIndex
+    {
+    public:
+        // false if the directory has no index (results from an older version of gaden) or it is not valid
+        bool Load(const std::filesystem::path& directory);
+
+        // picks up any snapshots that were appended since the index was last read (e.g. the simulation is still running)
+        // if the file got shorter (it was regenerated), it is read again from the start
+        void Refresh();
+        size_t Generation() const { return generation; } // changes every time the index is read again from the start
+        void SetQuiet(bool value) { quiet = value; }      // do not warn when the index has to be read again
+
+        void Add(const ResultsIndexEntry& entry) { entries.push_back(entry); } // for indices that are built in memory
+        const std::vector<ResultsIndexEntry>& Entries() const { return entries; }
+
+        const ResultsIndexEntry* Find(size_t iteration);   // nullptr if the iteration is not in the index
+        const ResultsIndexEntry* FindTime(double time); // last snapshot taken at or before 'time'. nullptr if there is none
+
+    private:
+        std::filesystem::path indexPath;
+        std::vector<ResultsIndexEntry> entries;
+        size_t indexBytesRead = 0;
+        size_t generation = 0;
+        bool quiet = false;
+    };
+
+    class ResultsContainerWriter
+    {
+    public:
+        ResultsContainerWriter(const std::filesystem::path& directory);
+
+        // compresses the snapshot and appends it to the container. Returns false if it could not be written
+        bool Append(ResultsIndexEntry entry, int compressionLevel, const uint8_t* data, size_t dataSize);
+
+    private:
+        std::ofstream dataFile;
+        ResultsIndexWriter indexWriter;
+        uint64_t dataSize = 0;
+    };
+
+    class ResultsContainerReader
+    {
+    public:
+        static bool Exists(const std::filesystem::path& directory);
+
+        // quiet -> nothing is logged after construction (e.g. the index being reloaded), so the reader can be used from a worker thread
+        ResultsContainerReader(const std::filesystem::path& directory, bool quiet = false);
+
+        ResultsIndex& Index() { return index; }
+
+        // the stored (compressed) snapshot of the given iteration, read straight from a mapping of the data file. nullptr if it is not in the container
+        // the pointer is valid until the next call, which might need to map the file again
+        const uint8_t* Snapshot(size_t iteration, size_t& size);
+
+        // decompresses the snapshot of the given iteration into 'output', which is grown as needed. See DecompressSnapshot for 'error'
+        bool Read(size_t iteration, std::vector<uint8_t>& output, size_t& outputSize, std::string* error = nullptr);
+
+    private:
+        std::filesystem::path dataPath;
+        MappedFile dataFile;
+        size_t mappedGeneration = 0; // of the index, when the data file was mapped
+        ResultsIndex index;
+    };
+} // namespace gaden
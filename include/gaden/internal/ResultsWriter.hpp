@@ -0,0 +1,64 @@
+#pragma once
+
+#include "gaden/internal/ResultsContainer.hpp"
+#include "gaden/internal/SnapshotCompression.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gaden
+{
+    // Compresses and writes the result snapshots of a RunningSimulation in a background thread, so that the simulation can keep going in the meantime
+    // the simulation serializes each snapshot into a buffer obtained from AcquireBuffer() and hands it back with Submit()
+    // there is a fixed number of buffers: if all of them are waiting to be written, AcquireBuffer() blocks until one is free (backpressure)
+    // the buffers start empty and keep whatever capacity the snapshots needed, so memory is only spent if (and as much as) results are actually saved
+    // the destructor waits for all pending snapshots to be on disk
+    // snapshots go either to their own file (directory/iteration_N) or to a single ResultsContainer in the directory. Either way, they are recorded in the results index
+    class ResultsWriter
+    {
+    public:
+        // maxQueuedSnapshots == 0 -> no background thread, every snapshot is written synchronously inside Submit()
+        ResultsWriter(const std::filesystem::path& directory, bool singleFile, size_t maxQueuedSnapshots, CompressionCodec codec, int compressionLevel);
+        ~ResultsWriter();
+        ResultsWriter(const ResultsWriter&) = delete;
+        ResultsWriter& operator=(const ResultsWriter&) = delete;
+
+        std::vector<uint8_t> AcquireBuffer();
+        void Submit(std::vector<uint8_t>&& buffer, size_t iteration, double time, size_t numFilaments);
+
+        // blocks until all the submitted snapshots have been written
+        void Flush();
+
+    private:
+        struct Job
+        {
+            std::vector<uint8_t> buffer;
+            ResultsIndexEntry entry; // offset and size are filled in by the container
+        };
+
+        void WorkerLoop();
+        void Write(const Job& job);
+
+    private:
+        std::filesystem::path directory;
+        std::unique_ptr<ResultsContainerWriter> container; // only if singleFile
+        std::unique_ptr<ResultsIndexWriter> index;         // only if not singleFile. The container keeps its own
+        CompressionCodec codec;
+        int compressionLevel;
+
+        std::mutex mutex;
+        std::condition_variable jobAvailable;
+        std::condition_variable bufferAvailable;
+        std::condition_variable queueEmpty;
+        std::deque<Job> queue;
+        std::vector<std::vector<uint8_t>> freeBuffers;
+        bool writing = false; // the worker has taken a job out of the queue and is not done with it yet
+        bool stopping = false;
+        std::thread worker;
+    };
+} // namespace gaden
@@ -0,0 +1,66 @@
+#pragma once
+#include "gaden/internal/AlignedVector.hpp"
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+
+namespace gaden
+{
+    // array of trivial values that grows in fixed-size, cache-line aligned chunks
+    // growing never moves the existing elements, so there is no need to guess the final size up front, and no reallocation spikes when the guess is wrong
+    // chunks are kept around when the array shrinks so they can be reused, which bounds the memory to the peak size plus less than one chunk
+    // the elements of a chunk are contiguous, so hot loops can go chunk by chunk (see chunkData) and still be vectorized
+    template <typename T, size_t ChunkSizeLog2 = 12>
+    class SegmentedVector
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+    public:
+        static constexpr size_t chunkSize = size_t(1) << ChunkSizeLog2;
+
+        SegmentedVector() = default;
+        SegmentedVector(const SegmentedVector&) = delete;
+        SegmentedVector& operator=(const SegmentedVector&) = delete;
+        SegmentedVector(SegmentedVector&&) = default;
+        SegmentedVector& operator=(SegmentedVector&&) = default;
+
+        size_t size() const { return count; }
+        size_t capacity() const { return chunks.size() * chunkSize; }
+        size_t memoryUsage() const { return capacity() * sizeof(T); } // bytes
+
+        T& operator[](size_t i) { return chunks[i >> ChunkSizeLog2][i & (chunkSize - 1)]; }
+        const T& operator[](size_t i) const { return chunks[i >> ChunkSizeLog2][i & (chunkSize - 1)]; }
+
+        // chunks that contain at least one element, and the number of elements in each of them
+        size_t numChunks() const { return (count + chunkSize - 1) >> ChunkSizeLog2; }
+        size_t chunkLength(size_t chunk) const { return std::min(chunkSize, count - (chunk << ChunkSizeLog2)); }
+        T* chunkData(size_t chunk) { return chunks[chunk].get(); }
+        const T* chunkData(size_t chunk) const { return chunks[chunk].get(); }
+
+        // new elements are left uninitialized
+        void resize(size_t n)
+        {
+            while (capacity() < n)
+                chunks.emplace_back(AlignedAllocator<T>().allocate(chunkSize));
+            count = n;
+        }
+
+        void push_back(const T& value)
+        {
+            if (count == capacity())
+                chunks.emplace_back(AlignedAllocator<T>().allocate(chunkSize));
+            (*this)[count++] = value;
+        }
+
+        void clear() { count = 0; }
+
+    private:
+        struct ChunkDeleter
+        {
+            void operator()(T* chunk) const { AlignedAllocator<T>().deallocate(chunk, chunkSize); }
+        };
+
+        std::vector<std::unique_ptr<T[], ChunkDeleter>> chunks;
+        size_t count = 0;
+    };
+} // namespace gaden
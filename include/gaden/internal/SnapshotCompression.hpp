@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace gaden
+{
+    // compression of the result files (one per saved iteration)
+    // zlib is always available. zstd and lz4 are only compiled in if the libraries are found at build time (GADEN_WITH_ZSTD, GADEN_WITH_LZ4)
+    enum class CompressionCodec : uint8_t
+    {
+        None = 0,
+        Zlib = 1,
+        Zstd = 2, // good ratio and much faster decompression than zlib. The level (1-22) trades compression speed for ratio without slowing down decompression
+        LZ4 = 3,  // fastest to compress and decompress, lowest ratio
+    };
+
+    bool CodecAvailable(CompressionCodec codec);
+    std::string CodecName(CompressionCodec codec);
+    bool CodecFromName(const std::string& name, CompressionCodec& codec); // false if the name is not recognized
+
+    // compressed files start with a small header that records the codec and the uncompressed size
+    // files without it are from before the header was introduced, and are plain zlib streams
+    inline constexpr char snapshotMagic[4] = {'G', 'D', 'N', 'S'};
+    inline constexpr size_t snapshotHeaderSize = 16; // magic, codec, 3 bytes of padding, uncompressed size (uint64)
+
+    // both directions work in blocks of this size, so there is never a second full-size copy of the snapshot in memory
+    inline constexpr size_t snapshotStreamBlockSize = 1 << 18;
+
+    // level 0 -> default for the codec. Returns the number of bytes written to 'output' (header included), or 0 if something went wrong
+    size_t CompressSnapshot(std::ostream& output, CompressionCodec codec, int level, const uint8_t* data, size_t dataSize);
+
+    // detects the codec from the header. 'output' is grown as needed, but never shrunk, so it can be reused across calls
+    // returns false if the data could not be decompressed. Does not log, so it can be used from any thread: if 'error' is given, it gets the reason, when there is one to give
+    bool DecompressSnapshot(std::istream& input, size_t inputSize, std::vector<uint8_t>& output, size_t& outputSize, std::string* error = nullptr);
+    bool DecompressSnapshot(const uint8_t* data, size_t dataSize, std::vector<uint8_t>& output, size_t& outputSize, std::string* error = nullptr);
+
+    // if the snapshot was stored without compression, points 'payload' at the data inside of it, so it can be used without a copy
+    // returns false if it is compressed (or not a valid snapshot), in which case it needs to go through DecompressSnapshot
+    bool UncompressedSnapshotPayload(const uint8_t* data, size_t dataSize, const uint8_t*& payload, size_t& payloadSize);
+} // namespace gaden
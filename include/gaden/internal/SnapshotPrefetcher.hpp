@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gaden
+{
+    // Reads and decodes the upcoming result snapshots of a PlaybackSimulation in background threads, so AdvanceTimestep() does not have to wait for the disk and the decompression
+    // it keeps up to 'depth' iterations in flight, following the playback order given by the 'next' function (which takes care of looping)
+    // if a memory budget is set, it stops reading ahead once the decoded snapshots it holds add up to that many bytes
+    // decoded buffers are handed over by swapping them with the caller's, and the caller's old buffer is reused for a later snapshot, so there are no copies or allocations once it warms up
+    class SnapshotPrefetcher
+    {
+    public:
+        // reads the snapshot of an iteration into 'output' (grown as needed). Called concurrently from all the worker threads. 'worker' is the index of the calling thread
+        using DecodeFunction = std::function<bool(size_t worker, size_t iteration, std::vector<uint8_t>& output, size_t& outputSize)>;
+        // iteration that is played after the given one
+        using NextFunction = std::function<size_t(size_t iteration)>;
+
+        SnapshotPrefetcher(DecodeFunction decode, NextFunction next, size_t depth, size_t memoryBudget, size_t numThreads);
+        ~SnapshotPrefetcher();
+        SnapshotPrefetcher(const SnapshotPrefetcher&) = delete;
+        SnapshotPrefetcher& operator=(const SnapshotPrefetcher&) = delete;
+
+        // waits until 'iteration' is decoded and swaps it into 'buffer'
+        // if it is not the iteration that was expected next (first call, or the caller jumped somewhere else), the pipeline starts over from it
+        // returns false if it could not be read
+        bool Take(size_t iteration, std::vector<uint8_t>& buffer, size_t& size);
+
+        // the caller got 'iteration' from somewhere else (e.g. the DecodedSnapshotCache), so it is dropped from the pipeline without waiting for it
+        void Skip(size_t iteration);
+
+    private:
+        enum class FrameState
+        {
+            Queued,
+            Decoding,
+            Ready,
+            Failed
+        };
+
+        struct Frame
+        {
+            uint64_t sequence = 0; // frames are identified by their position in the playback order, since the same iteration can come up again when looping
+            size_t iteration = 0;
+            FrameState state = FrameState::Queued;
+            std::vector<uint8_t> buffer = {};
+            size_t size = 0;
+        };
+
+        void WorkerLoop(size_t worker);
+        void Restart(size_t iteration);
+        void Schedule();
+        size_t BytesHeld() const;
+        std::vector<uint8_t> TakeFreeBuffer();
+        void RecycleBuffer(std::vector<uint8_t>&& buffer);
+
+    private:
+        DecodeFunction decode;
+        NextFunction next;
+        size_t depth;
+        size_t memoryBudget;
+        size_t expectedFrameSize = 0; // size of the last decoded snapshot, to estimate how much memory the ones that are still decoding will take
+
+        std::mutex mutex;
+        std::condition_variable frameQueued;
+        std::condition_variable frameDone;
+        std::deque<Frame> frames; // in playback order. The front is the next one to be taken
+        uint64_t nextSequence = 0;
+        std::vector<std::vector<uint8_t>> freeBuffers;
+        bool stopping = false;
+        std::vector<std::thread> workers;
+    };
+} // namespace gaden
@@ -0,0 +1,99 @@
+#pragma once
+#include "gaden/Environment.hpp"
+#include <array>
+#include <cmath>
+#include <limits>
+
+namespace gaden
+{
+    // Amanatides & Woo, "A Fast Voxel Traversal Algorithm for Ray Tracing" (1987)
+    // walks the cells crossed by the segment start->end in order, visiting each of them exactly once (including the ones that are only crossed through an edge)
+    // everything is done in cell units, so each step is an integer increment plus a comparison, and the linear index of the cell is updated incrementally
+    class VoxelTraversal
+    {
+    public:
+        VoxelTraversal(const Environment& environment, const Vector3& start, const Vector3& end)
+            : env(environment)
+        {
+            const Environment::Description& description = env.description;
+            Vector3 from = (start - description.minCoord) / description.cellSize;
+            Vector3 to = (end - description.minCoord) / description.cellSize;
+            Vector3 delta = to - from;
+
+            stride = {1, description.dimensions.x, (int64_t)description.dimensions.x * description.dimensions.y};
+            for (int axis = 0; axis < 3; axis++)
+            {
+                cell[axis] = std::floor(from[axis]);
+                int endCell = std::floor(to[axis]);
+                remaining[axis] = std::abs(endCell - cell[axis]);
+
+                if (delta[axis] > 0)
+                    step[axis] = 1;
+                else if (delta[axis] < 0)
+                    step[axis] = -1;
+                else
+                    step[axis] = 0;
+
+                if (step[axis] == 0)
+                {
+                    tMax[axis] = std::numeric_limits<float>::infinity();
+                    tDelta[axis] = std::numeric_limits<float>::infinity();
+                }
+                else
+                {
+                    float nextBoundary = step[axis] > 0 ? cell[axis] + 1 : cell[axis];
+                    tMax[axis] = (nextBoundary - from[axis]) / delta[axis];
+                    tDelta[axis] = 1.f / std::abs(delta[axis]);
+                }
+            }
+            index = cell.x + cell.y * stride[1] + cell.z * stride[2];
+        }
+
+        // moves to the next cell along the segment. Returns false once the cell that contains the end point has already been visited
+        bool Next()
+        {
+            int axis = -1;
+            for (int i = 0; i < 3; i++)
+                if (remaining[i] > 0 && (axis == -1 || tMax[i] < tMax[axis]))
+                    axis = i;
+
+            if (axis == -1)
+                return false;
+
+            entryT = tMax[axis];
+            entryNormal = {0, 0, 0};
+            entryNormal[axis] = -step[axis];
+
+            cell[axis] += step[axis];
+            index += step[axis] * stride[axis];
+            tMax[axis] += tDelta[axis];
+            remaining[axis]--;
+            return true;
+        }
+
+        // linear index of the current cell. Only meaningful if it is in bounds
+        size_t Index() const { return index; }
+
+        Environment::CellState State() const
+        {
+            const Vector3i& dimensions = env.description.dimensions;
+            if (cell.x < 0 || cell.y < 0 || cell.z < 0 || cell.x >= dimensions.x || cell.y >= dimensions.y || cell.z >= dimensions.z)
+                return Environment::CellState::OutOfBounds;
+            return env.cells[index];
+        }
+
+    public:
+        Vector3i cell;                    // current cell
+        Vector3i entryNormal = {0, 0, 0}; // normal of the face through which the segment entered the current cell (pointing back towards the previous cell). Zero for the starting cell
+        float entryT = 0;                 // fraction of the segment (0 to 1) at which it enters the current cell
+
+    private:
+        const Environment& env;
+        Vector3i step;
+        Vector3i remaining; // cells left to cross on each axis before reaching the cell of the end point
+        Vector3 tMax;       // value of t at which the segment crosses the next cell boundary on each axis
+        Vector3 tDelta;     // increment of t between two consecutive boundaries on each axis
+        std::array<int64_t, 3> stride;
+        int64_t index;
+    };
+} // namespace gaden
@@ -0,0 +1,173 @@
+#include <gaden/internal/DecodedSnapshotCache.hpp>
+
+namespace gaden
+{
+    DecodedSnapshotCache& DecodedSnapshotCache::Get()
+    {
+        static DecodedSnapshotCache cache;
+        return cache;
+    }
+
+    void DecodedSnapshotCache::SetMemoryBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        memoryBudget = bytes;
+        EvictOverBudget();
+    }
+
+    size_t DecodedSnapshotCache::GetMemoryBudget()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return memoryBudget;
+    }
+
+    size_t DecodedSnapshotCache::BytesHeld()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bytesHeld;
+    }
+
+    std::string DecodedSnapshotCache::CanonicalPath(const std::filesystem::path& directory)
+    {
+        std::error_code error;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(directory, error);
+        return error ? directory.lexically_normal().string() : canonical.string();
+    }
+
+    std::string DecodedSnapshotCache::DirectoryKey(const std::filesystem::path& directory)
+    {
+        std::string path = CanonicalPath(directory);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = directoryGenerations.find(path);
+        return path + '#' + std::to_string(it == directoryGenerations.end() ? 0 : it->second);
+    }
+
+    void DecodedSnapshotCache::InvalidateDirectory(const std::filesystem::path& directory)
+    {
+        std::string path = CanonicalPath(directory);
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string directoryKey = path + '#' + std::to_string(directoryGenerations[path]++);
+
+        // keys are sorted by directory first, so the snapshots of the directory are a single range of the lookup
+        auto it = lookup.lower_bound(Key(directoryKey, 0));
+        while (it != lookup.end() && it->first.first == directoryKey)
+        {
+            auto entry = it->second;
+            it++;
+            Remove(entry);
+        }
+    }
+
+    DecodedSnapshotCache::Handle DecodedSnapshotCache::Find(const std::string& directoryKey, size_t iteration)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = lookup.find(Key(directoryKey, iteration));
+        if (it == lookup.end())
+            return nullptr;
+
+        entries.splice(entries.end(), entries, it->second); // most recently used goes last
+        return it->second->snapshot;
+    }
+
+    bool DecodedSnapshotCache::Contains(const std::string& directoryKey, size_t iteration)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lookup.contains(Key(directoryKey, iteration));
+    }
+
+    DecodedSnapshotCache::Handle DecodedSnapshotCache::Insert(const std::string& directoryKey, size_t iteration, std::vector<uint8_t>&& buffer, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Key key(directoryKey, iteration);
+        if (auto it = lookup.find(key); it != lookup.end())
+        {
+            RecycleBuffer(std::move(buffer));
+            entries.splice(entries.end(), entries, it->second);
+            return it->second->snapshot;
+        }
+
+        auto snapshot = std::make_shared<DecodedSnapshot>(DecodedSnapshot{.buffer = std::move(buffer), .size = size});
+        lastSnapshotBytes = snapshot->buffer.capacity();
+        if (memoryBudget == 0 || lastSnapshotBytes > memoryBudget)
+            return snapshot; // would be evicted right away
+
+        entries.push_back(Entry{.key = key, .snapshot = snapshot});
+        lookup[key] = std::prev(entries.end());
+        bytesHeld += lastSnapshotBytes;
+        EvictOverBudget();
+        return snapshot;
+    }
+
+    DecodedSnapshotCache::Handle DecodedSnapshotCache::Wrap(std::vector<uint8_t>&& buffer, size_t size)
+    {
+        return std::make_shared<DecodedSnapshot>(DecodedSnapshot{.buffer = std::move(buffer), .size = size});
+    }
+
+    std::vector<uint8_t> DecodedSnapshotCache::TakeScratchBuffer()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!scratchBuffers.empty())
+        {
+            std::vector<uint8_t> buffer = std::move(scratchBuffers.back());
+            scratchBuffers.pop_back();
+            return buffer;
+        }
+
+        // the snapshot that is decoded into this buffer is going to push the least recently used one out of the cache anyway, so its buffer is taken right away
+        if (!entries.empty() && bytesHeld + lastSnapshotBytes > memoryBudget && entries.front().snapshot.use_count() == 1)
+        {
+            std::vector<uint8_t> buffer = std::move(entries.front().snapshot->buffer);
+            bytesHeld -= buffer.capacity();
+            lookup.erase(entries.front().key);
+            entries.pop_front();
+            return buffer;
+        }
+        return {};
+    }
+
+    void DecodedSnapshotCache::ReturnScratchBuffer(std::vector<uint8_t>&& buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        RecycleBuffer(std::move(buffer));
+    }
+
+    void DecodedSnapshotCache::Release(Handle&& handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // the cache holds a reference to everything it has, so a single reference means the snapshot is not cached, and nobody else is using it
+        // the buffer can be taken from it, since every snapshot was created (non-const) by this class
+        if (handle && handle.use_count() == 1)
+            RecycleBuffer(std::move(const_cast<DecodedSnapshot&>(*handle).buffer));
+        handle.reset();
+    }
+
+    void DecodedSnapshotCache::Clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        lookup.clear();
+        scratchBuffers.clear();
+        bytesHeld = 0;
+    }
+
+    void DecodedSnapshotCache::Remove(std::list<Entry>::iterator entry)
+    {
+        bytesHeld -= entry->snapshot->buffer.capacity();
+        if (entry->snapshot.use_count() == 1)
+            RecycleBuffer(std::move(entry->snapshot->buffer));
+        lookup.erase(entry->key);
+        entries.erase(entry);
+    }
+
+    void DecodedSnapshotCache::EvictOverBudget()
+    {
+        while (bytesHeld > memoryBudget && !entries.empty())
+            Remove(entries.begin());
+    }
+
+    void DecodedSnapshotCache::RecycleBuffer(std::vector<uint8_t>&& buffer)
+    {
+        if (buffer.capacity() > 0 && scratchBuffers.size() < maxScratchBuffers)
+            scratchBuffers.push_back(std::move(buffer));
+    }
+} // namespace gaden
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cfloat>
 #include <fstream>
 #include <gaden/Environment.hpp>
 #include <gaden/core/Logging.hpp>
@@ -170,9 +172,90 @@ namespace gaden
         }
 
         infile.close();
+        ComputeClearance();
         return ReadResult::OK;
     }
 
+    // 1D squared euclidean distance transform of a sampled function (Felzenszwalb & Huttenlocher, "Distance Transforms of Sampled Functions", 2012)
+    // v and z are scratch buffers of size n and n+1
+    static void DistanceTransform1D(const float* f, float* d, int n, int* v, float* z)
+    {
+        int k = 0;
+        v[0] = 0;
+        z[0] = -FLT_MAX;
+        z[1] = FLT_MAX;
+        for (int q = 1; q < n; q++)
+        {
+            float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+            while (s <= z[k])
+            {
+                k--;
+                s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+            }
+            k++;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = FLT_MAX;
+        }
+
+        k = 0;
+        for (int q = 0; q < n; q++)
+        {
+            while (z[k + 1] < q)
+                k++;
+            d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+        }
+    }
+
+    void Environment::ComputeClearance()
+    {
+        // exact euclidean distance transform, separable over the three axes
+        // starts at 0 for the non-free cells and "infinity" for the free ones, and ends up holding the squared distance (in cells) to the nearest non-free cell
+        constexpr float infinity = 1e20;
+        const Vector3i& dims = description.dimensions;
+        std::vector<float> squaredDistance(numCells());
+        for (size_t i = 0; i < cells.size(); i++)
+            squaredDistance[i] = cells[i] == CellState::Free ? infinity : 0;
+
+        const std::array<size_t, 3> strides = {1, (size_t)dims.x, (size_t)dims.x * dims.y};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int n = dims[axis];
+            int other1 = (axis + 1) % 3;
+            int other2 = (axis + 2) % 3;
+
+#pragma omp parallel
+            {
+                std::vector<float> f(n), d(n), z(n + 1);
+                std::vector<int> v(n);
+#pragma omp for collapse(2)
+                for (int a = 0; a < dims[other1]; a++)
+                    for (int b = 0; b < dims[other2]; b++)
+                    {
+                        size_t lineStart = a * strides[other1] + b * strides[other2];
+                        for (int q = 0; q < n; q++)
+                            f[q] = squaredDistance[lineStart + q * strides[axis]];
+                        DistanceTransform1D(f.data(), d.data(), n, v.data(), z.data());
+                        for (int q = 0; q < n; q++)
+                            squaredDistance[lineStart + q * strides[axis]] = d[q];
+                    }
+            }
+        }
+
+        // the distance above is between cell centers. A point can be anywhere inside its cell, and the obstacle occupies a whole cell, so we need to subtract one cell diagonal to be conservative
+        constexpr float cellDiagonal = 1.7320508f;
+        clearance.resize(numCells());
+#pragma omp parallel for
+        for (size_t i = 0; i < cells.size(); i++)
+        {
+            Vector3i idx = indicesFrom1D(i);
+            // the cells just outside of the map are also off-limits
+            float boundaryDistance = std::min({idx.x + 1, dims.x - idx.x, idx.y + 1, dims.y - idx.y, idx.z + 1, dims.z - idx.z});
+            float distance = std::min(std::sqrt(squaredDistance[i]), boundaryDistance);
+            clearance[i] = std::clamp(std::floor(distance - cellDiagonal), 0.f, 255.f);
+        }
+    }
+
     bool Environment::WriteToFile(const std::filesystem::path& path)
     {
         std::ofstream outfile(path.c_str());
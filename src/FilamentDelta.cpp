@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <gaden/internal/FilamentDelta.hpp>
+
+namespace gaden
+{
+    static constexpr size_t numDeltaWords = 5;                           // position (3), sigma, weight
+    static constexpr size_t deltaBytesPerFilament = numDeltaWords * 4 + 1; // plus 'active'
+
+    static void ToWords(const Filament& filament, uint32_t (&words)[numDeltaWords])
+    {
+        memcpy(&words[0], &filament.position.x, 4);
+        memcpy(&words[1], &filament.position.y, 4);
+        memcpy(&words[2], &filament.position.z, 4);
+        memcpy(&words[3], &filament.sigma, 4);
+        memcpy(&words[4], &filament.weight, 4);
+    }
+
+    static void FromWords(const uint32_t (&words)[numDeltaWords], Filament& filament)
+    {
+        memcpy(&filament.position.x, &words[0], 4);
+        memcpy(&filament.position.y, &words[1], 4);
+        memcpy(&filament.position.z, &words[2], 4);
+        memcpy(&filament.sigma, &words[3], 4);
+        memcpy(&filament.weight, &words[4], 4);
+    }
+
+    bool SortedByID(const std::vector<uint32_t>& ids)
+    {
+        return std::adjacent_find(ids.begin(), ids.end(), std::greater_equal<uint32_t>()) == ids.end();
+    }
+
+    void WriteFilamentDelta(BufferWriter& writer, const FilamentFrame& previous, const FilamentFrame& current)
+    {
+        std::vector<uint8_t> keptMask((previous.size() + 7) / 8, 0);
+        std::vector<std::pair<size_t, size_t>> kept; // (index in previous, index in current)
+        std::vector<uint32_t> addedIDs;
+        std::vector<Filament> added;
+
+        // both lists are sorted by id, so they can be matched in a single pass
+        size_t i = 0;
+        for (size_t j = 0; j < current.size(); j++)
+        {
+            while (i < previous.size() && previous.ids[i] < current.ids[j])
+                i++; // removed
+            if (i < previous.size() && previous.ids[i] == current.ids[j])
+            {
+                keptMask[i / 8] |= 1 << (i % 8);
+                kept.emplace_back(i, j);
+                i++;
+            }
+            else
+            {
+                addedIDs.push_back(current.ids[j]);
+                added.push_back(current.filaments[j]);
+            }
+        }
+
+        size_t numKept = kept.size();
+        std::vector<uint8_t> planes(numKept * deltaBytesPerFilament);
+        for (size_t k = 0; k < numKept; k++)
+        {
+            const Filament& before = previous.filaments[kept[k].first];
+            const Filament& after = current.filaments[kept[k].second];
+            uint32_t wordsBefore[numDeltaWords], wordsAfter[numDeltaWords];
+            ToWords(before, wordsBefore);
+            ToWords(after, wordsAfter);
+            for (size_t w = 0; w < numDeltaWords; w++)
+            {
+                uint32_t difference = wordsBefore[w] ^ wordsAfter[w];
+                for (size_t b = 0; b < 4; b++)
+                    planes[(w * 4 + b) * numKept + k] = difference >> (8 * b);
+            }
+            planes[numDeltaWords * 4 * numKept + k] = before.active != after.active;
+        }
+
+        size_t previousSize = previous.size();
+        writer.Write(&previousSize);
+        writer.Write(&keptMask);
+        writer.Write(&planes);
+        writer.Write(&addedIDs);
+        writer.Write(&added);
+    }
+
+    void ReadFilamentDelta(BufferReader& reader, const FilamentFrame& previous, FilamentFrame& current)
+    {
+        size_t previousSize;
+        std::vector<uint8_t> keptMask;
+        std::vector<uint8_t> planes;
+        std::vector<uint32_t> addedIDs;
+        std::vector<Filament> added;
+        reader.Read(&previousSize);
+        reader.Read(&keptMask);
+        reader.Read(&planes);
+        reader.Read(&addedIDs);
+        reader.Read(&added);
+
+        if (previousSize != previous.size() || keptMask.size() != (previousSize + 7) / 8 || addedIDs.size() != added.size())
+            throw std::out_of_range("Filament delta does not match the previous snapshot");
+
+        size_t numKept = 0;
+        for (uint8_t byte : keptMask)
+            numKept += std::popcount(byte);
+        if (planes.size() != numKept * deltaBytesPerFilament)
+            throw std::out_of_range("Filament delta does not match the previous snapshot");
+
+        current.filaments.clear();
+        current.ids.clear();
+        current.filaments.reserve(numKept + added.size());
+        current.ids.reserve(numKept + added.size());
+
+        // the new filaments go in between the kept ones, so the result stays sorted by id
+        size_t k = 0;
+        size_t a = 0;
+        for (size_t i = 0; i < previousSize; i++)
+        {
+            if (!(keptMask[i / 8] & (1 << (i % 8))))
+                continue;
+
+            while (a < added.size() && addedIDs[a] < previous.ids[i])
+            {
+                current.filaments.push_back(added[a]);
+                current.ids.push_back(addedIDs[a]);
+                a++;
+            }
+
+            uint32_t words[numDeltaWords];
+            ToWords(previous.filaments[i], words);
+            for (size_t w = 0; w < numDeltaWords; w++)
+            {
+                uint32_t difference = 0;
+                for (size_t b = 0; b < 4; b++)
+                    difference |= uint32_t(planes[(w * 4 + b) * numKept + k]) << (8 * b);
+                words[w] ^= difference;
+            }
+
+            Filament filament = previous.filaments[i];
+            FromWords(words, filament);
+            filament.active = previous.filaments[i].active != (planes[numDeltaWords * 4 * numKept + k] != 0);
+            current.filaments.push_back(filament);
+            current.ids.push_back(previous.ids[i]);
+            k++;
+        }
+        for (; a < added.size(); a++)
+        {
+            current.filaments.push_back(added[a]);
+            current.ids.push_back(addedIDs[a]);
+        }
+    }
+} // namespace gaden
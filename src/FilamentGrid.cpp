@@ -0,0 +1,56 @@
+#include <gaden/internal/FilamentGrid.hpp>
+
+namespace gaden
+{
+    void FilamentGrid::Build(std::span<const Filament> filaments, const Vector3& minCoord, const Vector3& maxCoord)
+    {
+        if (filaments.empty())
+        {
+            Clear();
+            return;
+        }
+
+        float maxRadius = 0;
+#pragma omp parallel for reduction(max : maxRadius)
+        for (size_t i = 0; i < filaments.size(); i++)
+            maxRadius = std::max(maxRadius, CutoffRadius(filaments[i]));
+
+        origin = minCoord;
+        Vector3 extent = maxCoord - minCoord;
+        size_t maxCells = std::max<size_t>(filaments.size() * maxCellsPerFilament, 64);
+        cellSize = std::max(maxRadius, 1e-3f);
+        while (true)
+        {
+            for (int i = 0; i < 3; i++)
+                dimensions[i] = int(std::max(extent[i], 0.f) / cellSize) + 1; // +1 so that points right at maxCoord still have a cell
+            if (size_t(dimensions.x) * dimensions.y * dimensions.z <= maxCells)
+                break;
+            cellSize *= 1.25f;
+        }
+        size_t numCells = size_t(dimensions.x) * dimensions.y * dimensions.z;
+
+        filamentCells.resize(filaments.size());
+#pragma omp parallel for
+        for (size_t i = 0; i < filaments.size(); i++)
+            filamentCells[i] = Index(CellOf(filaments[i].position));
+
+        // counting sort. The counts go two positions ahead, so that after the prefix sum cellStart[c+1] is the start of cell c,
+        // and after the scatter (which increments it once per filament) it is the start of cell c+1
+        cellStart.assign(numCells + 2, 0);
+        for (uint32_t cell : filamentCells)
+            cellStart[cell + 2]++;
+        for (size_t i = 2; i < cellStart.size(); i++)
+            cellStart[i] += cellStart[i - 1];
+
+        sortedFilaments.resize(filaments.size());
+        for (size_t i = 0; i < filaments.size(); i++)
+            sortedFilaments[cellStart[filamentCells[i] + 1]++] = filaments[i];
+    }
+
+    void FilamentGrid::Clear()
+    {
+        sortedFilaments.clear();
+        cellStart.clear();
+        dimensions = Vector3i(0);
+    }
+} // namespace gaden
@@ -0,0 +1,93 @@
+#include <cmath>
+#include <gaden/internal/FilamentKernels.hpp>
+#include <gaden/internal/Random.hpp>
+
+// one clone of each kernel per instruction set, dispatched at load time (ifunc). Elsewhere, a single version for whatever the compiler targets
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define GADEN_KERNEL_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef GADEN_KERNEL_CLONES
+#define GADEN_KERNEL_CLONES
+#endif
+
+namespace gaden
+{
+    GADEN_KERNEL_CLONES
+    void GenerateFilamentNoise(size_t count, const uint32_t* __restrict ids, uint64_t seed, uint64_t step,
+                               float* __restrict noiseX, float* __restrict noiseY, float* __restrict noiseZ)
+    {
+        // the scalar versions of the Philox and Box-Muller functions, so that nothing has to live in memory inside the loop
+        const philox::Key key = philox::KeyFromSeed(seed);
+        const uint32_t stepLow = static_cast<uint32_t>(step);
+        const uint32_t stepHigh = static_cast<uint32_t>(step >> 32);
+#pragma omp simd
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t bits0 = ids[i], bits1 = stepLow, bits2 = stepHigh, bits3 = static_cast<uint32_t>(RandomStream::FilamentNoise);
+            philox::Generate(bits0, bits1, bits2, bits3, key[0], key[1]);
+            philox::BoxMuller(bits0, bits1, noiseX[i], noiseY[i]);
+            noiseZ[i] = philox::BoxMuller(bits2, bits3);
+        }
+    }
+
+    GADEN_KERNEL_CLONES
+    void ComputeFilamentTargets(size_t count, const FilamentMoveInput& input, const FilamentMoveOutput& output, const FilamentMoveConstants& constants)
+    {
+        const float* __restrict x = input.x;
+        const float* __restrict y = input.y;
+        const float* __restrict z = input.z;
+        const float* __restrict birthTime = input.birthTime;
+        const float* __restrict weight = input.weight;
+        const float* __restrict windX = input.windX;
+        const float* __restrict windY = input.windY;
+        const float* __restrict windZ = input.windZ;
+        const float* __restrict noiseX = input.noiseX;
+        const float* __restrict noiseY = input.noiseY;
+        const float* __restrict noiseZ = input.noiseZ;
+        const uint8_t* __restrict clearance = input.clearance;
+        float* __restrict tx = output.targetX;
+        float* __restrict ty = output.targetY;
+        float* __restrict tz = output.targetZ;
+        uint8_t* __restrict clear = output.clearMove;
+
+        const float deltaTime = constants.deltaTime;
+        const float time = constants.time;
+        const float initialSigmaSqr = constants.initialSigmaSqr;
+        const float growthGamma = constants.growthGamma;
+        const float buoyancy = constants.buoyancy;
+        const float noiseStd = constants.noiseStd;
+        const float cellSize = constants.cellSize;
+
+#pragma omp simd
+        for (size_t i = 0; i < count; i++)
+        {
+            // 1. Simulate Advection (Va)
+            //    Large scale wind-eddies -> Movement of a filament as a whole by wind
+            //------------------------------------------------------------------------
+            float newX = x[i] + windX[i] * deltaTime;
+            float newY = y[i] + windY[i] * deltaTime;
+            float newZ = z[i] + windZ[i] * deltaTime;
+
+            // 2. Simulate Gravity & Bouyant Force
+            //------------------------------------
+            float invSigma = 1.f / std::sqrt(initialSigmaSqr + growthGamma * (time - birthTime[i]));
+            newZ += buoyancy * weight[i] * invSigma * invSigma * invSigma * deltaTime;
+
+            // 3. Add some variability (stochastic process)
+            //------------------------------------
+            tx[i] = newX + noiseX[i] * noiseStd * deltaTime;
+            ty[i] = newY + noiseY[i] * noiseStd * deltaTime;
+            tz[i] = newZ + noiseZ[i] * noiseStd * deltaTime;
+
+            // 4. Check whether the filament stays clear of any obstacle. If so, the collision checks can be skipped
+            //------------------------------------------------------------------------
+            float dx = tx[i] - x[i];
+            float dy = ty[i] - y[i];
+            float dz = tz[i] - z[i];
+            float clearDistance = clearance[i] * cellSize;
+            clear[i] = dx * dx + dy * dy + dz * dz < clearDistance * clearDistance;
+        }
+    }
+} // namespace gaden
@@ -0,0 +1,72 @@
+#include <fcntl.h>
+#include <gaden/internal/MappedFile.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace gaden
+{
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other) noexcept
+        : mappedData(std::exchange(other.mappedData, nullptr)), mappedSize(std::exchange(other.mappedSize, 0)), isOpen(std::exchange(other.isOpen, false))
+    {}
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            mappedData = std::exchange(other.mappedData, nullptr);
+            mappedSize = std::exchange(other.mappedSize, 0);
+            isOpen = std::exchange(other.isOpen, false);
+        }
+        return *this;
+    }
+
+    bool MappedFile::Open(const std::filesystem::path& path)
+    {
+        Close();
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        // mmap does not accept empty mappings, but an empty file is still a valid (empty) result
+        if (info.st_size > 0)
+        {
+            void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED)
+            {
+                close(fd);
+                return false;
+            }
+            mappedData = (const uint8_t*)address;
+            mappedSize = info.st_size;
+        }
+
+        close(fd); // the mapping stays valid after the descriptor is closed
+        isOpen = true;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (mappedData)
+            munmap(const_cast<uint8_t*>(mappedData), mappedSize);
+        mappedData = nullptr;
+        mappedSize = 0;
+        isOpen = false;
+    }
+} // namespace gaden
@@ -1,8 +1,12 @@
 #include "gaden/datatypes/sources/PointSource.hpp"
 #include "gaden/internal/BufferUtils.hpp"
-#include <fstream>
+#include <algorithm>
+#include <cmath>
 #include <gaden/PlaybackSimulation.hpp>
-#include <gaden/internal/compression.hpp>
+#include <gaden/internal/QuantizedFilaments.hpp>
+#include <gaden/internal/ResultsContainer.hpp>
+#include <gaden/internal/SnapshotCompression.hpp>
+#include <limits>
 
 namespace gaden
 {
@@ -23,65 +27,388 @@ namespace gaden
             }
         }
 
-        compressedBuffer.resize(maxBufferSize);
-        rawBuffer.resize(maxBufferSize);
+        if (parameters.sharedCache)
+            cacheKey = DecodedSnapshotCache::Get().DirectoryKey(parameters.resultsDirectory);
+
+        if (ResultsContainerReader::Exists(parameters.resultsDirectory))
+            container = std::make_unique<ResultsContainerReader>(parameters.resultsDirectory);
+
+        if (parameters.prefetchDepth > 0)
+        {
+            size_t numThreads = std::max<size_t>(parameters.prefetchThreads, 1);
+            if (container)
+            {
+                for (size_t i = 0; i < numThreads; i++)
+                    prefetchContainers.push_back(std::make_unique<ResultsContainerReader>(parameters.resultsDirectory, true));
+            }
+
+            prefetcher = std::make_unique<SnapshotPrefetcher>(
+                [this](size_t worker, size_t iteration, std::vector<uint8_t>& output, size_t& outputSize) {
+                    // nothing to do if it is already in the cache by the time the playback gets there (ReadIteration skips it). Otherwise it is read again
+                    if (parameters.sharedCache && DecodedSnapshotCache::Get().Contains(cacheKey, iteration))
+                    {
+                        outputSize = 0;
+                        return true;
+                    }
+                    return DecodeSnapshot(container ? prefetchContainers[worker].get() : nullptr, iteration, output, outputSize);
+                },
+                [this](size_t iteration) { return NextIteration(iteration); },
+                parameters.prefetchDepth, parameters.prefetchMemoryBudget, numThreads);
+        }
     }
 
     void PlaybackSimulation::AdvanceTimestep()
     {
-        std::string filename = fmt::format("{}/iteration_{}", parameters.resultsDirectory.c_str(), currentIteration);
-        if (!std::filesystem::exists(filename))
+        LoadIteration(currentIteration);
+        currentIteration = NextIteration(currentIteration);
+    }
+
+    bool PlaybackSimulation::SeekToIteration(size_t iteration)
+    {
+        if (!GetIndex().Find(iteration))
+        {
+            GADEN_ERROR("Iteration {} is not in the results in '{}'", iteration, parameters.resultsDirectory);
+            return false;
+        }
+
+        bool loaded = LoadIteration(iteration);
+        currentIteration = NextIteration(iteration);
+        return loaded;
+    }
+
+    bool PlaybackSimulation::SeekToTime(double time)
+    {
+        ResultsIndex& resultsIndex = GetIndex();
+        if (!resultsIndex.Entries().empty() && std::isnan(resultsIndex.Entries().front().time))
+        {
+            GADEN_ERROR("The results in '{}' are from an older version of gaden, which did not record the time of each iteration. Use SeekToIteration instead",
+                        parameters.resultsDirectory);
+            return false;
+        }
+
+        const ResultsIndexEntry* entry = resultsIndex.FindTime(time);
+        if (!entry)
+        {
+            GADEN_ERROR("No results in '{}' were saved at or before t={}s", parameters.resultsDirectory, time);
+            return false;
+        }
+        return SeekToIteration(entry->iteration);
+    }
+
+    bool PlaybackSimulation::StepBackward()
+    {
+        if (!loadedIteration)
+            return false;
+
+        std::optional<size_t> previous = PreviousIteration(*loadedIteration);
+        if (!previous)
+            return false;
+
+        bool loaded = LoadIteration(*previous);
+        currentIteration = NextIteration(*previous);
+        return loaded;
+    }
+
+    const std::vector<ResultsIndexEntry>& PlaybackSimulation::GetResultsIndex()
+    {
+        ResultsIndex& resultsIndex = GetIndex();
+        resultsIndex.Refresh();
+        return resultsIndex.Entries();
+    }
+
+    bool PlaybackSimulation::LoadIteration(size_t iteration)
+    {
+        InvalidateFilamentGrid();
+        bool loaded = ReadIteration(iteration);
+
+        // a delta snapshot can only be applied on top of the one before it. If that is not the one that is loaded (seeking, stepping backward, starting mid-way...),
+        // it has to be rebuilt starting from the last keyframe
+        if (loaded && missingKeyframe)
+        {
+            size_t keyframe = *missingKeyframe;
+            missingKeyframe.reset();
+            for (size_t i = keyframe; i <= iteration && loaded; i++)
+                loaded = ReadIteration(i) && !missingKeyframe;
+            missingKeyframe.reset();
+
+            if (reconstructedIteration != iteration)
+            {
+                GADEN_ERROR("Could not rebuild iteration {} in '{}' from keyframe {}", iteration, parameters.resultsDirectory, keyframe);
+                loaded = false;
+            }
+        }
+
+        if (!loaded)
+        {
+            filaments = {}; // might have pointed into data that is no longer there
+            loadedIteration.reset();
+            return false;
+        }
+
+        loadedIteration = iteration;
+        return true;
+    }
+
+    bool PlaybackSimulation::ReadIteration(size_t iteration)
+    {
+        DecodedSnapshotCache& cache = DecodedSnapshotCache::Get();
+        const DecodedSnapshot* decoded = nullptr;
+        if (DecodedFrame* frame = FindDecodedFrame(iteration))
+            decoded = frame->snapshot.get();
+        else if (DecodedSnapshotCache::Handle cached = parameters.sharedCache ? cache.Find(cacheKey, iteration) : nullptr)
+        {
+            if (prefetcher)
+                prefetcher->Skip(iteration);
+            decoded = KeepFrame(iteration, std::move(cached));
+        }
+        else if (prefetcher)
+        {
+            std::vector<uint8_t> buffer = cache.TakeScratchBuffer();
+            size_t size = 0;
+            if (prefetcher->Take(iteration, buffer, size) && size > 0) // empty if the prefetcher found it in the cache, but it was evicted since
+                decoded = KeepFrame(iteration, StoreDecoded(iteration, std::move(buffer), size));
+            else
+                cache.ReturnScratchBuffer(std::move(buffer));
+        }
+
+        const uint8_t* data;
+        size_t dataSize;
+        bool read = false;
+        if (decoded)
+        {
+            data = decoded->buffer.data();
+            dataSize = decoded->size;
+            read = true;
+        }
+        else
+            read = ReadSnapshot(iteration, data, dataSize); // no prefetching, or the prefetched read failed (e.g. the iteration had not been written yet at the time)
+
+        if (!read)
+            return false;
+
+        try
+        {
+            BufferReader reader((const char*)data, dataSize);
+
+            // check the version of gaden used to generate the file
+            reader.Read(&config.environment.versionMajor);
+            if (config.environment.versionMajor == 1)
+            {
+                config.environment.versionMinor = 0; // pre 2.0 files had no minor version
+                LoadLogfileVersion1(reader);
+            }
+            else if (config.environment.versionMajor == 2)
+            {
+                reader.Read(&config.environment.versionMinor, sizeof(int));
+                if (config.environment.versionMinor <= 5)
+                    LoadLogfileVersionPre2_6(reader);
+                else
+                    LoadLogfileVersion2_6(reader);
+            }
+            else
+            {
+                reader.Read(&config.environment.versionMinor, sizeof(int));
+                LoadLogfile(reader, iteration);
+            }
+        }
+        catch (std::out_of_range& e)
+        {
+            GADEN_ERROR("Iteration {} in '{}' is truncated or corrupted: {}", iteration, parameters.resultsDirectory, e.what());
+            return false;
+        }
+        return true;
+    }
+
+    PlaybackSimulation::DecodedFrame* PlaybackSimulation::FindDecodedFrame(size_t iteration)
+    {
+        auto it = std::find_if(decodedFrames.begin(), decodedFrames.end(), [iteration](const DecodedFrame& frame) { return frame.iteration == iteration; });
+        if (it == decodedFrames.end())
+            return nullptr;
+
+        // most recently used goes last, so it is the last one to be recycled
+        // moving the frame does not move its buffer's data, so pointers into it stay valid
+        DecodedFrame frame = std::move(*it);
+        decodedFrames.erase(it);
+        decodedFrames.push_back(std::move(frame));
+        return &decodedFrames.back();
+    }
+
+    // adds a frame as the most recently used one, dropping the least recently used one if there are already parameters.keptFrames
+    const DecodedSnapshot* PlaybackSimulation::KeepFrame(size_t iteration, DecodedSnapshotCache::Handle snapshot)
+    {
+        if (decodedFrames.size() >= std::max<size_t>(parameters.keptFrames, 1))
         {
-            GADEN_ERROR("File '{}' does not exist!", filename.c_str());
-            currentIteration++;
-            return;
+            DecodedSnapshotCache::Get().Release(std::move(decodedFrames.front().snapshot));
+            decodedFrames.pop_front();
         }
+        decodedFrames.push_back(DecodedFrame{.iteration = iteration, .snapshot = std::move(snapshot)});
+        return decodedFrames.back().snapshot.get();
+    }
+
+    DecodedSnapshotCache::Handle PlaybackSimulation::StoreDecoded(size_t iteration, std::vector<uint8_t>&& buffer, size_t size)
+    {
+        if (parameters.sharedCache)
+            return DecodedSnapshotCache::Get().Insert(cacheKey, iteration, std::move(buffer), size);
+        return DecodedSnapshotCache::Get().Wrap(std::move(buffer), size);
+    }
+
+    ResultsIndex& PlaybackSimulation::GetIndex()
+    {
+        if (indexLoaded)
+            return index;
+        indexLoaded = true;
+
+        if (index.Load(parameters.resultsDirectory))
+            return index;
+
+        // older results have no index. Make one from the files that are there
+        // their sizes are all we can know without reading them, the time and number of filaments are left unknown
+        for (size_t iteration = 0; std::filesystem::exists(SnapshotPath(iteration)); iteration++)
+        {
+            index.Add(ResultsIndexEntry{.iteration = iteration,
+                                        .size = std::filesystem::file_size(SnapshotPath(iteration)),
+                                        .time = std::numeric_limits<double>::quiet_NaN(),
+                                        .codec = CompressionCodec::Zlib});
+        }
+        return index;
+    }
 
-        // read the file
-        std::ifstream infile(filename, std::ios_base::binary | std::ios_base::ate);
-        size_t streamSize = infile.tellg();
-        infile.seekg(0, std::ios_base::beg);
-        infile.read((char*)compressedBuffer.data(), streamSize);
-        infile.close();
+    size_t PlaybackSimulation::NextIteration(size_t iteration) const
+    {
+        iteration++;
+        if (loopConfig.loop && iteration > loopConfig.to)
+            iteration = loopConfig.from;
+        return iteration;
+    }
 
-        // decompress the contents
-        zlib::uLongf bufferSize = rawBuffer.size();
-        zlib::uncompress(rawBuffer.data(), &bufferSize, compressedBuffer.data(), compressedBuffer.size());
+    std::optional<size_t> PlaybackSimulation::PreviousIteration(size_t iteration) const
+    {
+        if (loopConfig.loop && iteration == loopConfig.from)
+            return loopConfig.to;
+        if (iteration == 0)
+            return std::nullopt;
+        return iteration - 1;
+    }
 
-        BufferReader reader((char*)rawBuffer.data(), bufferSize);
+    std::filesystem::path PlaybackSimulation::SnapshotPath(size_t iteration) const
+    {
+        return parameters.resultsDirectory / fmt::format("iteration_{}", iteration);
+    }
 
-        // check the version of gaden used to generate the file
-        reader.Read(&config.environment.versionMajor);
-        if (config.environment.versionMajor == 1)
+    // finds the serialized data of an iteration
+    // the stored snapshot is read from a memory mapping. If it is uncompressed, 'data' points straight into the mapping, otherwise it is decompressed into one of the decodedFrames
+    bool PlaybackSimulation::ReadSnapshot(size_t iteration, const uint8_t*& data, size_t& dataSize)
+    {
+        const uint8_t* stored;
+        size_t storedSize;
+        if (container)
         {
-            config.environment.versionMinor = 0; // pre 2.0 files had no minor version
-            LoadLogfileVersion1(reader);
+            stored = container->Snapshot(iteration, storedSize);
+            if (!stored)
+            {
+                GADEN_ERROR("Could not read iteration {} from the results container in '{}'", iteration, parameters.resultsDirectory);
+                return false;
+            }
         }
-        else if (config.environment.versionMajor == 2)
+        else
+        {
+            std::filesystem::path filename = SnapshotPath(iteration);
+            if (!std::filesystem::exists(filename))
+            {
+                GADEN_ERROR("File '{}' does not exist!", filename);
+                return false;
+            }
+            if (!mappedSnapshot.Open(filename))
+            {
+                GADEN_ERROR("Could not open file '{}'", filename);
+                return false;
+            }
+            stored = mappedSnapshot.data();
+            storedSize = mappedSnapshot.size();
+        }
+
+        if (UncompressedSnapshotPayload(stored, storedSize, data, dataSize))
+            return true;
+
+        std::vector<uint8_t> buffer = DecodedSnapshotCache::Get().TakeScratchBuffer();
+        size_t size;
+        std::string error;
+        if (!DecompressSnapshot(stored, storedSize, buffer, size, &error))
         {
-            reader.Read(&config.environment.versionMinor, sizeof(int));
-            if (config.environment.versionMinor <= 5)
-                LoadLogfileVersionPre2_6(reader);
+            if (error.empty())
+                GADEN_ERROR("Could not decompress iteration {} in '{}'", iteration, parameters.resultsDirectory);
             else
-                LoadLogfileVersion2_6(reader);
+                GADEN_ERROR("Could not decompress iteration {} in '{}': {}", iteration, parameters.resultsDirectory, error);
+            DecodedSnapshotCache::Get().ReturnScratchBuffer(std::move(buffer));
+            return false;
+        }
+        const DecodedSnapshot* decoded = KeepFrame(iteration, StoreDecoded(iteration, std::move(buffer), size));
+        data = decoded->buffer.data();
+        dataSize = decoded->size;
+        return true;
+    }
+
+    // same as ReadSnapshot, but safe to call from the prefetch threads: it only touches its own container reader and output buffer, and does not log
+    // a failure only means the iteration is not prefetched. The consumer then reads it again with ReadSnapshot, which reports whatever went wrong
+    // the data always ends up in 'output', even if it was stored uncompressed, since it has to outlive the mapping
+    bool PlaybackSimulation::DecodeSnapshot(ResultsContainerReader* reader, size_t iteration, std::vector<uint8_t>& output, size_t& outputSize) const
+    {
+        MappedFile file;
+        const uint8_t* stored;
+        size_t storedSize;
+        if (reader)
+        {
+            stored = reader->Snapshot(iteration, storedSize);
+            if (!stored)
+                return false;
         }
         else
         {
-            reader.Read(&config.environment.versionMinor, sizeof(int));
-            LoadLogfile(reader);
+            if (!file.Open(SnapshotPath(iteration)))
+                return false;
+            stored = file.data();
+            storedSize = file.size();
         }
-        currentIteration++;
 
-        if (loopConfig.loop && currentIteration > loopConfig.to)
-            currentIteration = loopConfig.from;
+        const uint8_t* payload;
+        if (UncompressedSnapshotPayload(stored, storedSize, payload, outputSize))
+        {
+            if (output.size() < outputSize)
+                output.resize(outputSize);
+            memcpy(output.data(), payload, outputSize);
+            return true;
+        }
+        return DecompressSnapshot(stored, storedSize, output, outputSize);
     }
 
-    const std::vector<Filament>& PlaybackSimulation::GetFilaments() const
+    // the filaments are used in place if the array is aligned in the buffer, which is always the case for results from gaden 3.2 onwards
+    std::span<const Filament> PlaybackSimulation::ReadFilamentArray(BufferReader& reader)
     {
+        // since 3.2 the filament array is padded to be aligned in the file
+        if (config.environment.versionMinor >= 2)
+        {
+            uint8_t padding;
+            reader.Read(&padding);
+            reader.AdvancePointer(padding);
+        }
+
+        size_t numFilaments;
+        reader.Read(&numFilaments);
+        const Filament* data = reader.View<Filament>(numFilaments);
+        if ((uintptr_t)data % alignof(Filament) == 0)
+            return std::span<const Filament>(data, numFilaments);
+
+        activeFilaments.resize(numFilaments);
+        memcpy(activeFilaments.data(), data, numFilaments * sizeof(Filament));
         return activeFilaments;
     }
 
-    void PlaybackSimulation::LoadLogfile(BufferReader reader)
+    std::span<const Filament> PlaybackSimulation::GetFilaments() const
+    {
+        return filaments;
+    }
+
+    void PlaybackSimulation::LoadLogfile(BufferReader reader, size_t iteration)
     {
         reader.Read(&config.environment.description);
         GasSource::DeserializeBinary(reader, simulationMetadata.source);
@@ -97,8 +424,46 @@ namespace gaden
         if (modeStr == "filaments")
         {
             mode = Mode::Filaments;
-            activeFilaments.clear();
-            reader.Read(&activeFilaments);
+            if (config.environment.versionMinor == 0)
+                LoadFilamentsVersion3_0(reader);
+            else
+                filaments = ReadFilamentArray(reader);
+        }
+        else if (modeStr == "filaments_quantized")
+        {
+            mode = Mode::Filaments;
+            ReadQuantizedFilaments(reader, activeFilaments);
+            filaments = activeFilaments;
+        }
+        else if (modeStr == "filament_keyframe")
+        {
+            mode = Mode::Filaments;
+            reconstructedIteration.reset();
+            reader.Read(&reconstructed.ids);
+            std::span<const Filament> keyframeFilaments = ReadFilamentArray(reader);
+            if (keyframeFilaments.size() != reconstructed.ids.size())
+                throw std::out_of_range("Number of filament ids does not match the number of filaments");
+            reconstructed.filaments.assign(keyframeFilaments.begin(), keyframeFilaments.end()); // copied, since the next delta builds on top of it
+            filaments = reconstructed.filaments;
+            reconstructedIteration = iteration;
+        }
+        else if (modeStr == "filament_delta")
+        {
+            mode = Mode::Filaments;
+            size_t keyframeIteration, baseIteration;
+            reader.Read(&keyframeIteration);
+            reader.Read(&baseIteration);
+            if (reconstructedIteration == iteration)
+                filaments = reconstructed.filaments;
+            else if (reconstructedIteration != baseIteration)
+                missingKeyframe = keyframeIteration; // LoadIteration takes care of it
+            else
+            {
+                ReadFilamentDelta(reader, reconstructed, deltaScratch);
+                std::swap(reconstructed, deltaScratch);
+                filaments = reconstructed.filaments;
+                reconstructedIteration = iteration;
+            }
         }
         else if (modeStr == "concentrations")
         {
@@ -113,7 +478,7 @@ namespace gaden
         }
         else
         {
-            GADEN_SERIOUS_ERROR("File mode not recognized: '{}'. Something might have gone wrong with the binary serialization.");
+            GADEN_SERIOUS_ERROR("File mode not recognized: '{}'. Something might have gone wrong with the binary serialization.", modeStr);
             GADEN_TERMINATE;
         }
     }
@@ -186,6 +551,7 @@ namespace gaden
 
             activeFilaments.emplace_back(x, y, z, stdDev);
         }
+        filaments = activeFilaments;
     }
 
     void PlaybackSimulation::LoadLogfileVersionPre2_6(BufferReader reader)
@@ -225,6 +591,7 @@ namespace gaden
 
             activeFilaments.emplace_back(x, y, z, stdDev);
         }
+        filaments = activeFilaments;
     }
 
     void PlaybackSimulation::LoadLogfileVersion2_6(BufferReader reader)
@@ -253,5 +620,25 @@ namespace gaden
 
             activeFilaments.emplace_back(x, y, z, stdDev);
         }
+        filaments = activeFilaments;
+    }
+
+    void PlaybackSimulation::LoadFilamentsVersion3_0(BufferReader& reader)
+    {
+        // 3.0 filaments had no weight
+        struct FilamentVersion3_0
+        {
+            Vector3 position;
+            float sigma;
+            bool active;
+        };
+
+        std::vector<FilamentVersion3_0> oldFilaments;
+        reader.Read(&oldFilaments);
+        activeFilaments.clear();
+        activeFilaments.reserve(oldFilaments.size());
+        for (const FilamentVersion3_0& filament : oldFilaments)
+            activeFilaments.emplace_back(filament.position, filament.sigma);
+        filaments = activeFilaments;
     }
 } // namespace gaden
\ No newline at end of file
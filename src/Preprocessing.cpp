@@ -51,6 +51,7 @@ namespace gaden
         Occupy(allOutletTriangles, environment, Environment::CellState::Outlet);
 
         Fill(environment, emptyPoint);
+        environment.ComputeClearance();
         return environment;
     }
 
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cmath>
+#include <gaden/internal/QuantizedFilaments.hpp>
+
+namespace gaden
+{
+    static constexpr float quantizationSteps = 65535;
+
+    static uint16_t Quantize(float value, float min, float max)
+    {
+        float normalized = max > min ? (value - min) / (max - min) : 0;
+        return std::lround(std::clamp(normalized, 0.f, 1.f) * quantizationSteps);
+    }
+
+    static float Dequantize(uint16_t value, float min, float max)
+    {
+        return min + (max - min) * (value / quantizationSteps);
+    }
+
+    void WriteQuantizedFilaments(BufferWriter& writer, const std::vector<Filament>& filaments, const Vector3& minCoord, const Vector3& maxCoord)
+    {
+        // the quantization ranges go in the data, so it can be decoded on its own
+        Vector3 min = minCoord;
+        Vector3 max = maxCoord;
+        float logSigmaMin = std::log(quantizedSigmaMin);
+        float logSigmaMax = std::log(quantizedSigmaMax);
+        writer.Write(&min);
+        writer.Write(&max);
+        writer.Write(&logSigmaMin);
+        writer.Write(&logSigmaMax);
+
+        // one array per attribute, since similar values next to each other compress better
+        size_t numFilaments = filaments.size();
+        std::vector<uint16_t> quantized(numFilaments * 4);
+        uint8_t hasWeights = false;
+        for (size_t i = 0; i < numFilaments; i++)
+        {
+            const Filament& filament = filaments[i];
+            quantized[i] = Quantize(filament.position.x, min.x, max.x);
+            quantized[numFilaments + i] = Quantize(filament.position.y, min.y, max.y);
+            quantized[2 * numFilaments + i] = Quantize(filament.position.z, min.z, max.z);
+            quantized[3 * numFilaments + i] = Quantize(std::log(filament.sigma), logSigmaMin, logSigmaMax);
+            hasWeights |= filament.weight != 1;
+        }
+        writer.Write(&numFilaments);
+        writer.Write(quantized.data(), quantized.size() * sizeof(uint16_t));
+
+        writer.Write(&hasWeights);
+        if (hasWeights)
+        {
+            for (const Filament& filament : filaments)
+                writer.Write(&filament.weight);
+        }
+    }
+
+    void ReadQuantizedFilaments(BufferReader& reader, std::vector<Filament>& filaments)
+    {
+        Vector3 min, max;
+        float logSigmaMin, logSigmaMax;
+        reader.Read(&min);
+        reader.Read(&max);
+        reader.Read(&logSigmaMin);
+        reader.Read(&logSigmaMax);
+
+        size_t numFilaments;
+        reader.Read(&numFilaments);
+        if (numFilaments > SIZE_MAX / 4) // corrupted, and the size of the view below would overflow
+            throw std::out_of_range("Tried to read past the end of the buffer");
+        const uint16_t* quantized = reader.View<uint16_t>(numFilaments * 4);
+
+        filaments.resize(numFilaments);
+        for (size_t i = 0; i < numFilaments; i++)
+        {
+            uint16_t values[4];
+            for (size_t attribute = 0; attribute < 4; attribute++)
+                memcpy(&values[attribute], quantized + attribute * numFilaments + i, sizeof(uint16_t)); // the buffer is not necessarily aligned
+
+            Filament& filament = filaments[i];
+            filament.position.x = Dequantize(values[0], min.x, max.x);
+            filament.position.y = Dequantize(values[1], min.y, max.y);
+            filament.position.z = Dequantize(values[2], min.z, max.z);
+            filament.sigma = std::exp(Dequantize(values[3], logSigmaMin, logSigmaMax));
+            filament.weight = 1;
+            filament.active = true;
+        }
+
+        uint8_t hasWeights;
+        reader.Read(&hasWeights);
+        if (hasWeights)
+        {
+            for (Filament& filament : filaments)
+                reader.Read(&filament.weight);
+        }
+    }
+} // namespace gaden
@@ -0,0 +1,181 @@
+#include "gaden/core/Logging.hpp"
+#include <algorithm>
+#include <cstring>
+#include <gaden/internal/ResultsContainer.hpp>
+
+namespace gaden
+{
+    static constexpr char indexMagic[4] = {'G', 'D', 'N', 'I'};
+    static constexpr uint32_t indexFormatVersion = 1;
+    static constexpr size_t indexHeaderSize = sizeof(indexMagic) + sizeof(indexFormatVersion);
+
+    ResultsIndexWriter::ResultsIndexWriter(const std::filesystem::path& directory)
+        : indexFile(directory / resultsIndexFileName, std::ios_base::binary | std::ios_base::trunc)
+    {
+        if (!indexFile)
+            GADEN_ERROR("Could not create results index in '{}'", directory);
+
+        indexFile.write(indexMagic, sizeof(indexMagic));
+        indexFile.write((char*)&indexFormatVersion, sizeof(indexFormatVersion));
+        indexFile.flush();
+    }
+
+    bool ResultsIndexWriter::Append(const ResultsIndexEntry& entry)
+    {
+        indexFile.write((char*)&entry, sizeof(entry));
+        indexFile.flush();
+        return bool(indexFile);
+    }
+
+    bool ResultsIndex::Load(const std::filesystem::path& directory)
+    {
+        indexPath = directory / resultsIndexFileName;
+        entries.clear();
+        indexBytesRead = 0;
+
+        std::ifstream indexFile(indexPath, std::ios_base::binary);
+        if (!indexFile)
+            return false;
+
+        char magic[sizeof(indexMagic)];
+        uint32_t version = 0;
+        indexFile.read(magic, sizeof(magic));
+        indexFile.read((char*)&version, sizeof(version));
+        if (!indexFile || memcmp(magic, indexMagic, sizeof(indexMagic)) != 0 || version != indexFormatVersion)
+        {
+            GADEN_ERROR("'{}' is not a valid results index", indexPath);
+            return false;
+        }
+        indexBytesRead = indexHeaderSize;
+        Refresh();
+        return true;
+    }
+
+    void ResultsIndex::Refresh()
+    {
+        if (indexBytesRead == 0) // not loaded from a file
+            return;
+
+        std::ifstream indexFile(indexPath, std::ios_base::binary | std::ios_base::ate);
+        if (!indexFile)
+            return; // e.g. a new simulation is clearing the directory to write its results there. Whatever was read is still the best there is
+        std::streamoff end = indexFile.tellg();
+        if (end < 0)
+            return;
+        size_t fileSize = end;
+
+        if (fileSize < indexBytesRead)
+        {
+            // the index was truncated or written again from scratch, so the entries that were read no longer describe the container
+            if (!quiet)
+                GADEN_WARN("Results index '{}' was rewritten, reloading it", indexPath);
+            entries.clear();
+            indexBytesRead = indexHeaderSize;
+            generation++;
+            if (fileSize <= indexBytesRead)
+                return;
+        }
+
+        size_t newEntries = (fileSize - indexBytesRead) / sizeof(ResultsIndexEntry); // a partially written entry at the end is left for the next refresh
+        if (fileSize <= indexBytesRead || newEntries == 0)
+            return;
+
+        indexFile.seekg(indexBytesRead);
+        size_t previousSize = entries.size();
+        entries.resize(previousSize + newEntries);
+        indexFile.read((char*)(entries.data() + previousSize), newEntries * sizeof(ResultsIndexEntry));
+        indexBytesRead += newEntries * sizeof(ResultsIndexEntry);
+    }
+
+    const ResultsIndexEntry* ResultsIndex::Find(size_t iteration)
+    {
+        if (iteration >= entries.size() || entries.back().iteration < iteration)
+            Refresh();
+
+        // snapshots are numbered consecutively, so the entry is normally at the position of its iteration
+        if (iteration < entries.size() && entries[iteration].iteration == iteration)
+            return &entries[iteration];
+
+        auto it = std::lower_bound(entries.begin(), entries.end(), iteration, [](const ResultsIndexEntry& entry, size_t value) { return entry.iteration < value; });
+        if (it != entries.end() && it->iteration == iteration)
+            return &(*it);
+        return nullptr;
+    }
+
+    const ResultsIndexEntry* ResultsIndex::FindTime(double time)
+    {
+        if (entries.empty() || entries.back().time < time)
+            Refresh();
+
+        auto it = std::upper_bound(entries.begin(), entries.end(), time, [](double value, const ResultsIndexEntry& entry) { return value < entry.time; });
+        if (it == entries.begin())
+            return nullptr;
+        return &(*(it - 1));
+    }
+
+    ResultsContainerWriter::ResultsContainerWriter(const std::filesystem::path& directory)
+        : dataFile(directory / resultsContainerFileName, std::ios_base::binary | std::ios_base::trunc), indexWriter(directory)
+    {
+        if (!dataFile)
+            GADEN_ERROR("Could not create results container in '{}'", directory);
+    }
+
+    bool ResultsContainerWriter::Append(ResultsIndexEntry entry, int compressionLevel, const uint8_t* data, size_t size)
+    {
+        // start every snapshot at an aligned offset, so uncompressed ones can be used in place from a memory mapping
+        static constexpr char zeros[resultsContainerAlignment] = {};
+        size_t padding = (resultsContainerAlignment - dataSize % resultsContainerAlignment) % resultsContainerAlignment;
+        dataFile.write(zeros, padding);
+        dataSize += padding;
+
+        entry.offset = dataSize;
+        entry.size = CompressSnapshot(dataFile, entry.codec, compressionLevel, data, size);
+        dataFile.flush();
+        if (entry.size == 0 || !dataFile)
+            return false;
+        dataSize += entry.size;
+
+        // only now that the data is complete does the snapshot become visible to readers
+        return indexWriter.Append(entry);
+    }
+
+    bool ResultsContainerReader::Exists(const std::filesystem::path& directory)
+    {
+        return std::filesystem::exists(directory / resultsContainerFileName) && std::filesystem::exists(directory / resultsIndexFileName);
+    }
+
+    ResultsContainerReader::ResultsContainerReader(const std::filesystem::path& directory, bool quiet)
+        : dataPath(directory / resultsContainerFileName)
+    {
+        index.Load(directory);
+        index.SetQuiet(quiet);
+    }
+
+    const uint8_t* ResultsContainerReader::Snapshot(size_t iteration, size_t& size)
+    {
+        const ResultsIndexEntry* entry = index.Find(iteration);
+        if (!entry)
+            return nullptr;
+
+        // the data file grows while the simulation is running, so it is mapped again if the snapshot is past the end of the current mapping
+        // or if the index was reloaded, in which case the mapping might be of a data file that has since been replaced
+        if (entry->offset + entry->size > dataFile.size() || mappedGeneration != index.Generation())
+        {
+            MappedFile remapped;
+            if (!remapped.Open(dataPath) || entry->offset + entry->size > remapped.size())
+                return nullptr;
+            dataFile = std::move(remapped);
+            mappedGeneration = index.Generation();
+        }
+
+        size = entry->size;
+        return dataFile.data() + entry->offset;
+    }
+
+    bool ResultsContainerReader::Read(size_t iteration, std::vector<uint8_t>& output, size_t& outputSize, std::string* error)
+    {
+        size_t size;
+        const uint8_t* data = Snapshot(iteration, size);
+        return data && DecompressSnapshot(data, size, output, outputSize, error);
+    }
+} // namespace gaden
@@ -0,0 +1,135 @@
+#include "gaden/core/Logging.hpp"
+#include <fstream>
+#include <gaden/internal/ResultsWriter.hpp>
+
+namespace gaden
+{
+    ResultsWriter::ResultsWriter(const std::filesystem::path& resultsDirectory, bool singleFile, size_t maxQueuedSnapshots, CompressionCodec compressionCodec, int level)
+        : directory(resultsDirectory), codec(compressionCodec), compressionLevel(level)
+    {
+        if (!CodecAvailable(codec))
+        {
+            GADEN_WARN("Compression codec '{}' is not available in this build of gaden. Using zlib instead", CodecName(codec));
+            codec = CompressionCodec::Zlib;
+        }
+
+        if (singleFile)
+            container = std::make_unique<ResultsContainerWriter>(directory);
+        else
+            index = std::make_unique<ResultsIndexWriter>(directory);
+
+        // one buffer for each queued snapshot, plus the one the simulation is filling
+        freeBuffers.resize(maxQueuedSnapshots + 1);
+
+        if (maxQueuedSnapshots > 0)
+            worker = std::thread(&ResultsWriter::WorkerLoop, this);
+    }
+
+    ResultsWriter::~ResultsWriter()
+    {
+        Flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        if (worker.joinable())
+            worker.join();
+    }
+
+    std::vector<uint8_t> ResultsWriter::AcquireBuffer()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        bufferAvailable.wait(lock, [this] { return !freeBuffers.empty(); });
+        std::vector<uint8_t> buffer = std::move(freeBuffers.back());
+        freeBuffers.pop_back();
+        return buffer;
+    }
+
+    void ResultsWriter::Submit(std::vector<uint8_t>&& buffer, size_t iteration, double time, size_t numFilaments)
+    {
+        Job job{std::move(buffer), ResultsIndexEntry{.iteration = iteration, .numFilaments = numFilaments, .time = time, .codec = codec}};
+        if (!worker.joinable())
+        {
+            Write(job);
+            std::lock_guard<std::mutex> lock(mutex);
+            freeBuffers.push_back(std::move(job.buffer));
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    void ResultsWriter::Flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        queueEmpty.wait(lock, [this] { return queue.empty() && !writing; });
+    }
+
+    void ResultsWriter::WorkerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            jobAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) // only possible if we are stopping
+                return;
+
+            Job job = std::move(queue.front());
+            queue.pop_front();
+            writing = true;
+
+            lock.unlock();
+            Write(job);
+            lock.lock();
+
+            freeBuffers.push_back(std::move(job.buffer));
+            writing = false;
+            bufferAvailable.notify_one();
+            if (queue.empty())
+                queueEmpty.notify_all();
+        }
+    }
+
+    void ResultsWriter::Write(const Job& job)
+    {
+        if (container)
+        {
+            if (!container->Append(job.entry, compressionLevel, job.buffer.data(), job.buffer.size()))
+                GADEN_ERROR("Could not append iteration {} to the results container in '{}'", job.entry.iteration, directory);
+            return;
+        }
+
+        // the compressed data goes to disk as it is produced, into a temporary file that only gets its final name once it is complete
+        // a reader (playback, or the index fallback that lists the files) never sees a half-written snapshot, and a crash only leaves the .tmp behind
+        std::filesystem::path path = directory / fmt::format("iteration_{}", job.entry.iteration);
+        std::filesystem::path tmpPath = directory / fmt::format("iteration_{}.tmp", job.entry.iteration);
+        std::ofstream resultsFile(tmpPath, std::ios_base::binary);
+        ResultsIndexEntry entry = job.entry;
+        entry.size = CompressSnapshot(resultsFile, codec, compressionLevel, job.buffer.data(), job.buffer.size());
+        resultsFile.close();
+        if (entry.size == 0 || !resultsFile)
+        {
+            GADEN_ERROR("Could not write results file '{}'", tmpPath);
+            std::error_code ignored;
+            std::filesystem::remove(tmpPath, ignored);
+            return;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tmpPath, path, error);
+        if (error)
+        {
+            GADEN_ERROR("Could not rename '{}' to '{}': {}", tmpPath, path, error.message());
+            return;
+        }
+
+        // same as in the container, the snapshot is only added to the index once the file is complete and in place
+        if (!index->Append(entry))
+            GADEN_ERROR("Could not add iteration {} to the results index in '{}'", entry.iteration, directory);
+    }
+} // namespace gaden
@@ -2,15 +2,27 @@
 #include "YAML_Conversions.hpp"
 #include "gaden/datatypes/GasTypes.hpp"
 #include "gaden/internal/BufferUtils.hpp"
+#include "gaden/internal/DecodedSnapshotCache.hpp"
+#include "gaden/internal/FilamentKernels.hpp"
+#include "gaden/internal/FilamentGrid.hpp"
 #include "gaden/internal/MathUtils.hpp"
 #include "gaden/internal/PathUtils.hpp"
+#include "gaden/internal/Random.hpp"
+#include "gaden/internal/VoxelTraversal.hpp"
+#include <algorithm>
+#include <array>
+#include <cfloat>
 #include <fstream>
-#include <gaden/internal/compression.hpp>
+#include <omp.h>
 #include <yaml-cpp/yaml.h>
 
 namespace gaden
 {
-    static thread_local PrecalculatedGaussian<1000> gaussian; // random values following a gaussian distribution, precomputed for speed
+    // how far from the face of an obstacle (in cells) a filament is left when it collides with it
+    static constexpr float contactOffset = 1e-3;
+
+    // side (in cells) of the blocks of the concentration grid that are filled by a single thread in preCalculateConcentrations mode
+    static constexpr int concentrationTileSize = 8;
 
     RunningSimulation::RunningSimulation(Parameters params, EnvironmentConfiguration const& envConfig)
         : parameters(params), Simulation(envConfig)
@@ -23,8 +35,6 @@ namespace gaden
         // so, to keep things more or less the same (good), we will scale the noise std by the most commonly used delta time -- 1/10th of a second
         parameters.filamentNoise_std *= 10;
 
-        filaments1.reserve(params.expectedNumIterations * params.numFilaments_sec / params.deltaTime);
-        filaments2.reserve(params.expectedNumIterations * params.numFilaments_sec / params.deltaTime);
         activeFilaments = &filaments1;
         auxFilamentsVector = &filaments2;
 
@@ -38,17 +48,46 @@ namespace gaden
         float filament_moles_cm3_center = params.filamentPPMcenter_initial / 1e6 * simulationMetadata.constants.numMolesAllGasesIncm3;                  //[moles of target gas / cm³]
         simulationMetadata.constants.totalMolesInFilament = filament_moles_cm3_center * (sqrt(8 * pow(M_PI, 3)) * pow(params.filamentInitialSigma, 3)); // total number of moles in a filament
 
-        rawBuffer.resize(maxBufferSize);
-        compressedBuffer.resize(maxBufferSize);
+        // Estimte filament acceleration due to gravity & Bouyant force (for the given gas_type):
+        // Approximation from "Terminal Velocity of a Bubble Rise in a Liquid Column", World Academy of Science, Engineering and Technology 28 2007
+        // the velocity is proportional to the concentration at the center of the filament, which is totalMolesInFilament / (sqrt(8*pi³) * sigma³), in ppm
+        {
+            constexpr float g = 9.8;
+            constexpr float ro_air = 1.205; //[kg/m³] density of air
+            constexpr float mu = 19 * 1e-6; //[kg/s·m] dynamic viscosity of air
+            size_t gasIndex = static_cast<size_t>(simulationMetadata.source->gasType);
+            float ppmTimesSigmaCubed = 1e6 * simulationMetadata.constants.totalMolesInFilament / (sqrt(8 * pow(M_PI, 3)) * simulationMetadata.constants.numMolesAllGasesIncm3);
+            buoyancyCoefficient = (g * (1 - SpecificGravity.at(gasIndex)) * ro_air * ppmTimesSigmaCubed * 1e-6) / (18 * mu);
+        }
+
+        // the concentration at the center of a filament is weight * C_0 * (sigma_0 / sigma)³, so the ppm threshold is equivalent to a limit on sigma:
+        //  sigma² > sigma_0² * (C_0 / C_min)^(2/3) * weight^(2/3)
+        // it is not turned into an age limit, since merged filaments have different weights. retirementSigmaSqr is the part that does not depend on the weight,
+        // and MoveFilaments compares the sigma² of each filament against it, scaled by the weight of that filament
+        maxFilamentAge = parameters.filamentMaxAge > 0 ? parameters.filamentMaxAge : FLT_MAX;
+        retirementSigmaSqr = FLT_MAX;
+        if (parameters.filamentMinPPMcenter > 0)
+            retirementSigmaSqr = parameters.filamentInitialSigma * parameters.filamentInitialSigma *
+                                 std::pow(parameters.filamentPPMcenter_initial / parameters.filamentMinPPMcenter, 2.f / 3.f);
+
+        if (parameters.maxActiveFilaments > 0 && parameters.filamentGrowthGamma <= 0)
+            GADEN_WARN("Filament merging is enabled with filamentGrowthGamma = {}. Merged filaments will not grow to cover the space that the original filaments occupied", parameters.filamentGrowthGamma);
+
         localAirflowDisturbances.resize(config.environment.numCells(), Vector3(0, 0, 0));
 
         paths::TryCreateDirectory(parameters.saveDataDirectory);
         if (parameters.saveResults)
         {
             GADEN_INFO("Saving results in directory '{}'", parameters.saveDataDirectory);
+            DecodedSnapshotCache::Get().InvalidateDirectory(parameters.saveDataDirectory); // playbacks in this process must not be served snapshots of the old results
             std::filesystem::remove_all(parameters.saveDataDirectory); // clear any pre-existing results to avoid mixing two different simulations
             if (!std::filesystem::create_directory(parameters.saveDataDirectory))
                 GADEN_ERROR("Could not create directory '{}'", parameters.saveDataDirectory);
+            resultsWriter = std::make_unique<ResultsWriter>(parameters.saveDataDirectory, parameters.saveSingleFile, parameters.saveQueueDepth,
+                                                            parameters.saveCompression, parameters.saveCompressionLevel);
+
+            if (parameters.saveQuantized && parameters.saveKeyframeInterval > 0)
+                GADEN_WARN("saveQuantized has no effect when saveKeyframeInterval is set. The results will be saved as keyframes and deltas, without loss of precision");
         }
 
         if (parameters.preCalculateConcentrations)
@@ -63,8 +102,12 @@ namespace gaden
 
     void RunningSimulation::AdvanceTimestep()
     {
+        stepStatistics = StepStatistics{};
         AddFilaments();
+        if (parameters.maxActiveFilaments > 0 && activeFilaments->size() > parameters.maxActiveFilaments)
+            MergeFilaments();
         MoveFilaments();
+        InvalidateFilamentGrid();
 
         if (parameters.preCalculateConcentrations)
             UpdateConcentrations();
@@ -85,9 +128,35 @@ namespace gaden
         currentIteration++;
     }
 
-    const std::vector<Filament>& RunningSimulation::GetFilaments() const
+    std::span<const Filament> RunningSimulation::GetFilaments() const
     {
-        return *activeFilaments;
+        // the filaments are stored as SoA internally. Build the AoS version on demand
+        std::lock_guard<std::mutex> lock(filamentsViewMutex);
+        if (filamentsViewDirty)
+        {
+            filamentsView.resize(activeFilaments->size());
+#pragma omp parallel for
+            for (size_t i = 0; i < activeFilaments->size(); i++)
+                filamentsView[i] = activeFilaments->get(i, FilamentSigma(activeFilaments->birthTime[i]));
+            filamentsViewDirty = false;
+        }
+        return filamentsView;
+    }
+
+    RunningSimulation::FilamentPoolUsage RunningSimulation::GetFilamentPoolUsage() const
+    {
+        FilamentPoolUsage usage;
+        usage.filaments = activeFilaments->size();
+        usage.capacity = std::min(filaments1.capacity(), filaments2.capacity());
+        usage.bytes = filaments1.memoryUsage() + filaments2.memoryUsage() //
+                      + targetX.memoryUsage() + targetY.memoryUsage() + targetZ.memoryUsage() + clearMove.memoryUsage();
+        return usage;
+    }
+
+    void RunningSimulation::FlushResults()
+    {
+        if (resultsWriter)
+            resultsWriter->Flush();
     }
 
     Vector3 RunningSimulation::SampleWind(const Vector3i& indices) const
@@ -108,190 +177,541 @@ namespace gaden
             constexpr size_t safetyLimit = 10;
             size_t attempts = 0;
 
+            CounterRNG rng(parameters.seed, nextFilamentID, RandomStream::Emission);
             Vector3 position;
             do
             {
-                position = simulationMetadata.source->Emit();
+                position = simulationMetadata.source->Emit(rng);
                 attempts++;
             } while (!config.environment.IsInBounds(position) && attempts < safetyLimit);
 
             GADEN_VERIFY(attempts < safetyLimit, "Could not spawn filaments around source position! Is it inside the environment bounds?");
 
-            activeFilaments->emplace_back(position, parameters.filamentInitialSigma);
+            activeFilaments->push_back(position, currentTime, nextFilamentID++);
         }
 
         releaseAccumulator = releaseAccumulator - std::floor(releaseAccumulator);
+        filamentsViewDirty = true;
     }
 
     void RunningSimulation::MoveFilaments()
     {
-#pragma omp parallel for
-        for (size_t i = 0; i < activeFilaments->size(); i++)
-            MoveSingleFilament(activeFilaments->at(i));
+        FilamentStore& filaments = *activeFilaments;
+        size_t numFilaments = filaments.size();
 
-        // eliminate filaments that exited the environment and swap the vector pointers
-        for (size_t i = 0; i < activeFilaments->size(); i++)
+        ComputeTargetPositions();
+
+        // Check filament location and eliminate the filaments that exited the environment
+        // each thread owns a contiguous range of filaments. It moves them, counts how many survive, and then copies the survivors to the other store
+        // starting at the offset given by the survivors of all the previous threads. This keeps the filaments in the same order as a serial pass
+        //------------------------------------
+        std::vector<size_t> survivorOffsets(omp_get_max_threads() + 1, 0);
+#pragma omp parallel
         {
-            Filament& filament = activeFilaments->at(i);
-            if (filament.active)
-                auxFilamentsVector->push_back(filament);
+            size_t numThreads = omp_get_num_threads();
+            size_t thread = omp_get_thread_num();
+            size_t rangeStart = numFilaments * thread / numThreads;
+            size_t rangeEnd = numFilaments * (thread + 1) / numThreads;
+
+            size_t survivors = 0;
+            StepStatistics threadStatistics;
+            for (size_t i = rangeStart; i < rangeEnd; i++)
+            {
+                if (!filaments.active[i]) // merged into another filament
+                    continue;
+
+                float age = filamentsTime - filaments.emissionTime[i];
+                float sigmaSqr = parameters.filamentInitialSigma * parameters.filamentInitialSigma + parameters.filamentGrowthGamma * (filamentsTime - filaments.birthTime[i]);
+                float weightFactor = filaments.weight[i] == 1 ? 1 : std::cbrt(filaments.weight[i] * filaments.weight[i]);
+                if (age > maxFilamentAge || sigmaSqr > retirementSigmaSqr * weightFactor)
+                {
+                    filaments.active[i] = false;
+                    threadStatistics.retiredFilaments++;
+                    continue;
+                }
+
+                threadStatistics.movedFilaments++;
+                if (clearMove[i])
+                {
+                    filaments.setPosition(i, {targetX[i], targetY[i], targetZ[i]});
+                    threadStatistics.freeMoves++;
+                    survivors++;
+                    continue;
+                }
+
+                try
+                {
+                    Vector3 position = filaments.position(i);
+                    Environment::CellState destinationState = StepTowards(position, {targetX[i], targetY[i], targetZ[i]}, threadStatistics);
+                    GADEN_ASSERT(config.environment.IsInBounds(position), "Filament is outside environment!");
+                    filaments.setPosition(i, position);
+
+                    if (destinationState == Environment::CellState::Outlet)
+                    {
+                        filaments.active[i] = false;
+                        threadStatistics.exitedFilaments++;
+                    }
+                }
+                catch (std::exception& e)
+                {
+                    GADEN_WARN("Exception Updating Filaments: {}", e.what());
+                }
+                survivors += filaments.active[i];
+            }
+            survivorOffsets[thread + 1] = survivors;
+
+#pragma omp critical
+            {
+                stepStatistics.movedFilaments += threadStatistics.movedFilaments;
+                stepStatistics.freeMoves += threadStatistics.freeMoves;
+                stepStatistics.exitedFilaments += threadStatistics.exitedFilaments;
+                stepStatistics.retiredFilaments += threadStatistics.retiredFilaments;
+                stepStatistics.cellsTraversed += threadStatistics.cellsTraversed;
+                stepStatistics.maxCellsTraversed = std::max(stepStatistics.maxCellsTraversed, threadStatistics.maxCellsTraversed);
+                stepStatistics.collisions += threadStatistics.collisions;
+                stepStatistics.bounceLimitReached += threadStatistics.bounceLimitReached;
+            }
+
+#pragma omp barrier
+#pragma omp single
+            {
+                for (size_t t = 0; t < numThreads; t++)
+                    survivorOffsets[t + 1] += survivorOffsets[t];
+                auxFilamentsVector->resize(survivorOffsets[numThreads]);
+            } // implicit barrier
+
+            size_t writeIndex = survivorOffsets[thread];
+            for (size_t i = rangeStart; i < rangeEnd; i++)
+            {
+                if (filaments.active[i])
+                    auxFilamentsVector->copyFrom(filaments, i, writeIndex++);
+            }
         }
 
         activeFilaments->clear();
         std::swap(activeFilaments, auxFilamentsVector);
+        filamentsTime = currentTime + parameters.deltaTime;
+        numRetiredFilaments += stepStatistics.retiredFilaments;
+        filamentsViewDirty = true;
     }
 
-    void RunningSimulation::MoveSingleFilament(Filament& filament)
+    // level-of-detail pass to keep the number of filaments within parameters.maxActiveFilaments
+    // the filaments are binned on a grid aligned with the environment cells, and all the eligible filaments that share a bin are replaced by a single one
+    // that keeps their total amount of gas, their center of mass and their spread (the merged sigma is the one of a gaussian with the same second moment)
+    // if that is not enough, the bins are made twice as large and the process repeats. Filaments that are still smaller than parameters.mergeMinSigma
+    // are only merged as a last resort, once the bins cover the whole environment
+    // merged-away filaments are marked as inactive, and removed by the compaction in MoveFilaments
+    void RunningSimulation::MergeFilaments()
     {
-        // Estimte filament acceleration due to gravity & Bouyant force (for the given gas_type):
-        constexpr float g = 9.8;
-        constexpr float specific_gravity_air = 1; //[dimensionless]
-        size_t gasIndex = static_cast<size_t>(simulationMetadata.source->gasType);
-
-        try
+        FilamentStore& filaments = *activeFilaments;
+        const size_t numFilaments = filaments.size();
+        const Environment::Description& description = config.environment.description;
+        const float initialSigmaSqr = parameters.filamentInitialSigma * parameters.filamentInitialSigma;
+        const float mergeMinSigma = parameters.mergeMinSigma * description.cellSize * 100; // to cm
+        constexpr uint32_t noBin = std::numeric_limits<uint32_t>::max();
+
+        std::vector<uint32_t> binOf(numFilaments);
+        std::vector<uint32_t> binStart;
+        std::vector<uint32_t> sortedFilaments(numFilaments);
+
+        size_t numActive = numFilaments;
+        bool mergeSmallFilaments = false;
+        for (int level = 0; numActive > parameters.maxActiveFilaments; level++)
         {
-            // Get 3D cell of the filament center
-            Vector3i cellIdx = config.environment.coordsToIndices(filament.position);
+            const int binCells = 1 << level;
+            const Vector3i numBins = (description.dimensions + binCells - 1) / binCells;
+            const size_t totalBins = (size_t)numBins.x * numBins.y * numBins.z;
 
-            // 1. Simulate Advection (Va)
-            //    Large scale wind-eddies -> Movement of a filament as a whole by wind
-            //------------------------------------------------------------------------
-            gaden::Vector3 windVec = SampleWind(cellIdx);
-            Vector3 newPosition = filament.position + windVec * parameters.deltaTime;
-
-            // 2. Simulate Gravity & Bouyant Force
-            //------------------------------------
-            // OLD approach: using accelerations (pure gas)
-
-            // float accel = g * (specific_gravity_air - SpecificGravity[gasIndex]) / SpecificGravity[gasIndex];
-            // newpos_z = filament.position_z + 0.5*accel*pow(parameters.deltaTime,2);
+            // find the bin of every filament that can be merged this round
+#pragma omp parallel for
+            for (size_t i = 0; i < numFilaments; i++)
+            {
+                binOf[i] = noBin;
+                if (!filaments.active[i] || (!mergeSmallFilaments && FilamentSigma(filaments.birthTime[i]) < mergeMinSigma))
+                    continue;
+                Vector3i cell = config.environment.coordsToIndices(filaments.position(i));
+                for (int axis = 0; axis < 3; axis++)
+                    cell[axis] = std::clamp(cell[axis], 0, description.dimensions[axis] - 1) / binCells;
+                binOf[i] = cell.x + cell.y * numBins.x + cell.z * numBins.x * numBins.y;
+            }
 
-            // Approximation from "Terminal Velocity of a Bubble Rise in a Liquid Column", World Academy of Science, Engineering and Technology 28 2007
-            constexpr float ro_air = 1.205; //[kg/m³] density of air
-            constexpr float mu = 19 * 1e-6; //[kg/s·m] dynamic viscosity of air
-            float terminal_buoyancy_velocity = (g * (1 - SpecificGravity.at(gasIndex)) * ro_air * ConcentrationAtCenter(filament) * 1e-6) / (18 * mu);
-            newPosition.z += terminal_buoyancy_velocity * parameters.deltaTime;
+            // counting sort. The filaments of each bin end up in index order, so the result of the merge does not depend on the number of threads
+            binStart.assign(totalBins + 1, 0);
+            for (size_t i = 0; i < numFilaments; i++)
+                if (binOf[i] != noBin)
+                    binStart[binOf[i] + 1]++;
+            for (size_t bin = 0; bin < totalBins; bin++)
+                binStart[bin + 1] += binStart[bin];
+            {
+                std::vector<uint32_t> cursor(binStart.begin(), binStart.end() - 1);
+                for (size_t i = 0; i < numFilaments; i++)
+                    if (binOf[i] != noBin)
+                        sortedFilaments[cursor[binOf[i]]++] = i;
+            }
 
-            // 3. Add some variability (stochastic process)
-            //------------------------------------
+            size_t merged = 0;
+#pragma omp parallel for schedule(dynamic, 256) reduction(+ : merged)
+            for (size_t bin = 0; bin < totalBins; bin++)
+            {
+                const uint32_t first = binStart[bin];
+                const uint32_t last = binStart[bin + 1];
+                if (last - first < 2)
+                    continue;
+
+                double totalWeight = 0;
+                Vector3 center(0, 0, 0);
+                for (uint32_t j = first; j < last; j++)
+                {
+                    uint32_t i = sortedFilaments[j];
+                    totalWeight += filaments.weight[i];
+                    center += filaments.position(i) * filaments.weight[i];
+                }
+                center /= (float)totalWeight;
+
+                // variance of the mixture along each axis, averaged over the three of them. Positions are in m, sigma in cm
+                double sigmaSqr = 0;
+                double emissionTime = 0;
+                for (uint32_t j = first; j < last; j++)
+                {
+                    uint32_t i = sortedFilaments[j];
+                    float sigma = FilamentSigma(filaments.birthTime[i]);
+                    sigmaSqr += filaments.weight[i] * (sigma * sigma + 1e4 * vmath::sqrlength(filaments.position(i) - center) / 3);
+                    emissionTime += filaments.weight[i] * filaments.emissionTime[i];
+                    filaments.active[i] = false;
+                }
+                sigmaSqr /= totalWeight;
+                emissionTime /= totalWeight;
+
+                // the merged filament takes the place of the first one of the bin
+                // its birth time is chosen so that FilamentSigma gives back the merged sigma, while its emission time (and so its age) is the average of the gas in it
+                uint32_t target = sortedFilaments[first];
+                filaments.setPosition(target, center);
+                filaments.weight[target] = totalWeight;
+                if (parameters.filamentGrowthGamma > 0)
+                    filaments.birthTime[target] = filamentsTime - (sigmaSqr - initialSigmaSqr) / parameters.filamentGrowthGamma;
+                filaments.emissionTime[target] = (float)emissionTime;
+                filaments.active[target] = true;
+                merged += last - first - 1;
+            }
+            numActive -= merged;
 
-            newPosition.x += gaussian.nextValue(0, parameters.filamentNoise_std) * parameters.deltaTime;
-            newPosition.y += gaussian.nextValue(0, parameters.filamentNoise_std) * parameters.deltaTime;
-            newPosition.z += gaussian.nextValue(0, parameters.filamentNoise_std) * parameters.deltaTime;
+            if (numBins == Vector3i(1, 1, 1))
+            {
+                if (mergeSmallFilaments)
+                    break;
+                mergeSmallFilaments = true;
+                level = -1;
+            }
+        }
 
-            // 4. Check filament location
-            //------------------------------------
-            Environment::CellState destinationState = StepTowards(filament, newPosition);
-            GADEN_ASSERT(config.environment.IsInBounds(filament.position), "Filament is outside environment!");
+        stepStatistics.mergedFilaments = numFilaments - numActive;
+        filamentsViewDirty = true;
+    }
 
-            if (destinationState == Environment::CellState::Outlet)
-                filament.active = false;
+    // computes where each filament would end up this step if there were no obstacles
+    // the per-cell values are gathered into SoA arrays first, so that the kernels themselves are flat arithmetic loops that get vectorized (see FilamentKernels.hpp)
+    void RunningSimulation::ComputeTargetPositions()
+    {
+        FilamentStore& filaments = *activeFilaments;
+        size_t numFilaments = filaments.size();
+        targetX.resize(numFilaments);
+        targetY.resize(numFilaments);
+        targetZ.resize(numFilaments);
+        clearMove.resize(numFilaments);
+        noiseX.resize(numFilaments);
+        noiseY.resize(numFilaments);
+        noiseZ.resize(numFilaments);
+        windX.resize(numFilaments);
+        windY.resize(numFilaments);
+        windZ.resize(numFilaments);
+        cellClearance.resize(numFilaments);
+
+        const Environment::Description& description = config.environment.description;
+        const Vector3* wind = config.windSequence.GetCurrent().data();
+        const Vector3* disturbances = localAirflowDisturbances.data();
+        const uint8_t* clearance = config.environment.clearance.data();
+        const uint64_t seed = parameters.seed;
+        const uint64_t step = currentIteration;
+        const FilamentMoveConstants constants{
+            .deltaTime = parameters.deltaTime,
+            .time = filamentsTime,
+            .initialSigmaSqr = parameters.filamentInitialSigma * parameters.filamentInitialSigma,
+            .growthGamma = parameters.filamentGrowthGamma,
+            .buoyancy = buoyancyCoefficient,
+            .noiseStd = parameters.filamentNoise_std,
+            .cellSize = description.cellSize,
+        };
 
-            // 4. Filament growth with time (this affects the posterior estimation of gas concentration at each cell)
-            //    Vd (small scale wind eddies) -> Difussion or change of the filament shape (growth with time)
-            //    R = sigma of a 3D gaussian -> Increasing sigma with time
-            //------------------------------------------------------------------------
-            filament.sigma += parameters.filamentGrowthGamma / (2 * filament.sigma) * parameters.deltaTime;
-        }
-        catch (std::exception& e)
+#pragma omp parallel for
+        for (size_t chunk = 0; chunk < filaments.numChunks(); chunk++)
         {
-            GADEN_WARN("Exception Updating Filaments: {}", e.what());
-            return;
+            size_t length = filaments.chunkLength(chunk);
+            const float* x = filaments.x.chunkData(chunk);
+            const float* y = filaments.y.chunkData(chunk);
+            const float* z = filaments.z.chunkData(chunk);
+            float* gatheredX = windX.chunkData(chunk);
+            float* gatheredY = windY.chunkData(chunk);
+            float* gatheredZ = windZ.chunkData(chunk);
+            uint8_t* gatheredClearance = cellClearance.chunkData(chunk);
+
+            // gather the values of the cell of each filament
+            for (size_t i = 0; i < length; i++)
+            {
+                int cellX = (x[i] - description.minCoord.x) / description.cellSize;
+                int cellY = (y[i] - description.minCoord.y) / description.cellSize;
+                int cellZ = (z[i] - description.minCoord.z) / description.cellSize;
+                size_t cellIndex = cellX + cellY * description.dimensions.x + cellZ * description.dimensions.x * description.dimensions.y;
+                Vector3 cellWind = wind[cellIndex] + disturbances[cellIndex];
+                gatheredX[i] = cellWind.x;
+                gatheredY[i] = cellWind.y;
+                gatheredZ[i] = cellWind.z;
+                gatheredClearance[i] = clearance[cellIndex];
+            }
+
+            GenerateFilamentNoise(length, filaments.id.chunkData(chunk), seed, step, noiseX.chunkData(chunk), noiseY.chunkData(chunk), noiseZ.chunkData(chunk));
+
+            FilamentMoveInput input{
+                .x = x,
+                .y = y,
+                .z = z,
+                .birthTime = filaments.birthTime.chunkData(chunk),
+                .weight = filaments.weight.chunkData(chunk),
+                .windX = gatheredX,
+                .windY = gatheredY,
+                .windZ = gatheredZ,
+                .noiseX = noiseX.chunkData(chunk),
+                .noiseY = noiseY.chunkData(chunk),
+                .noiseZ = noiseZ.chunkData(chunk),
+                .clearance = gatheredClearance,
+            };
+            FilamentMoveOutput output{
+                .targetX = targetX.chunkData(chunk),
+                .targetY = targetY.chunkData(chunk),
+                .targetZ = targetZ.chunkData(chunk),
+                .clearMove = clearMove.chunkData(chunk),
+            };
+            ComputeFilamentTargets(length, input, output, constants);
         }
     }
 
-    // move the filament as much as possible towards the desired final position, stopping if we find an obstacle along the way
-    Environment::CellState RunningSimulation::StepTowards(Filament& filament, Vector3 end)
+    // Filament growth with time (this affects the posterior estimation of gas concentration at each cell)
+    // Vd (small scale wind eddies) -> Difussion or change of the filament shape (growth with time)
+    // R = sigma of a 3D gaussian -> Increasing sigma with time, d(sigma)/dt = gamma / (2*sigma)
+    // which integrates to sigma² = sigma_0² + gamma * age, so there is no need to store sigma or update it every step
+    float RunningSimulation::FilamentSigma(float birthTime) const
     {
-        Vector3i startCell = config.environment.coordsToIndices(filament.position);
-        Vector3i endCell = config.environment.coordsToIndices(end);
+        return std::sqrt(parameters.filamentInitialSigma * parameters.filamentInitialSigma + parameters.filamentGrowthGamma * (filamentsTime - birthTime));
+    }
 
-        if (startCell == endCell)
+    // move the filament as much as possible towards the desired final position, sliding along the obstacles found along the way
+    // the number of slides is capped by parameters.maxCollisionBounces, so a single filament never costs more than (maxCollisionBounces+1) traversals of its displacement
+    Environment::CellState RunningSimulation::StepTowards(Vector3& position, Vector3 end, StepStatistics& cost)
+    {
+        const float cellSize = config.environment.description.cellSize;
+        size_t cellsTraversed = 0;
+        auto finish = [&](Environment::CellState state)
         {
-            filament.position = end;
-            return config.environment.at(startCell);
-        }
-
-        // Calculate displacement vector
-        Vector3 movementDir = end - filament.position;
-        float distance = vmath::length(movementDir);
-        movementDir = vmath::normalized(movementDir);
+            cost.cellsTraversed += cellsTraversed;
+            cost.maxCellsTraversed = std::max(cost.maxCellsTraversed, cellsTraversed);
+            return state;
+        };
 
-        // Traverse path
-        int steps = ceil(distance / config.environment.description.cellSize); // Make sure no two iteration steps are separated more than 1 cell
-        float increment = distance / steps;
-
-        for (int i = 0; i < steps; i++)
+        for (size_t bounce = 0;; bounce++)
         {
-            // Determine point in space to evaluate
-            Vector3 previous = filament.position;
-            filament.position += movementDir * increment;
+            Vector3 start = position;
+            Vector3 displacement = end - start;
+
+            // walk the cells between the current position and the destination, in order
+            VoxelTraversal traversal(config.environment, start, end);
+            Environment::CellState cellState = traversal.State();
+            bool collided = false;
+            while (!collided && traversal.Next())
+            {
+                cellsTraversed++;
+                cellState = traversal.State();
+                if (cellState == Environment::CellState::Outlet)
+                {
+                    position = start + displacement * traversal.entryT - Vector3(traversal.entryNormal) * (contactOffset * cellSize);
+                    return finish(cellState);
+                }
+                collided = cellState == Environment::CellState::Obstacle || cellState == Environment::CellState::OutOfBounds;
+            }
 
-            // Check if the cell is occupied
-            Environment::CellState cellState = config.environment.at(filament.position);
-            if (cellState == Environment::CellState::Obstacle || cellState == Environment::CellState::OutOfBounds)
+            if (!collided)
             {
-                Vector3i previousCell = config.environment.coordsToIndices(previous);
-                Vector3i currentCell = config.environment.coordsToIndices(filament.position);
-                Vector3 normal = previousCell - currentCell;
+                // Direct line of sight confirmed!
+                position = end;
+                return finish(cellState);
+            }
 
-                filament.position = previous;
+            // stop right before the face we crossed to get into the occupied cell
+            cost.collisions++;
+            Vector3 normal = traversal.entryNormal;
+            position = start + displacement * traversal.entryT + normal * (contactOffset * cellSize);
 
-                Vector3 remaining = end - filament.position;
-                Vector3 rejected = remaining - vmath::project(remaining, normal);
+            // the contact point can fall on an edge of the occupied cell due to floating point error. In that case, don't move at all this step
+            Environment::CellState contactState = config.environment.at(position);
+            if (contactState == Environment::CellState::Obstacle || contactState == Environment::CellState::OutOfBounds)
+            {
+                position = start;
+                return finish(Environment::CellState::Free);
+            }
 
-                return StepTowards(filament, filament.position + rejected);
+            if (bounce == parameters.maxCollisionBounces)
+            {
+                cost.bounceLimitReached++;
+                return finish(Environment::CellState::Free);
             }
-            else if (cellState == Environment::CellState::Outlet)
-                return cellState;
-        }
 
-        // Direct line of sight confirmed!
-        return Environment::CellState::Free;
+            // slide along the face with the rest of the displacement
+            Vector3 remaining = end - position;
+            end = position + remaining - vmath::project(remaining, normal);
+        }
     }
 
     void RunningSimulation::UpdateConcentrations()
     {
-#pragma parallel for
-        for (size_t i = 0; i < concentrations->size(); i++)
-            concentrations->at(i) = 0;
+        // the grid is split in tiles, and each tile is cleared and filled by a single thread with the filaments that overlap it, so there is no need for atomics or per-thread copies of the grid
+        // the filaments of each cell are added in the order in which they are stored, so the result does not depend on the number of threads
+        const Environment& environment = config.environment;
+        const Vector3i& dimensions = environment.description.dimensions;
+        std::span<const Filament> filaments = GetFilaments();
+
+        // cells within the cutoff radius of a filament (inclusive bounds)
+        auto filamentBounds = [&](const Filament& filament, Vector3i& bbMin, Vector3i& bbMax) {
+            float radius = FilamentGrid::CutoffRadius(filament);
+            bbMin = environment.coordsToIndices(filament.position - radius);
+            bbMax = environment.coordsToIndices(filament.position + radius);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                bbMin[axis] = std::clamp(bbMin[axis], 0, dimensions[axis] - 1);
+                bbMax[axis] = std::clamp(bbMax[axis], 0, dimensions[axis] - 1);
+            }
+        };
 
-        for (Filament const& filament : *activeFilaments)
+        // bin the filaments by the tiles they overlap (counting sort, same as FilamentGrid)
+        Vector3i numTiles = (dimensions + concentrationTileSize - 1) / concentrationTileSize;
+        size_t totalTiles = size_t(numTiles.x) * numTiles.y * numTiles.z;
+        tileStart.assign(totalTiles + 2, 0);
+        for (int pass = 0; pass < 2; pass++)
         {
-            Vector3i bbMin = config.environment.coordsToIndices(filament.position - filament.sigma * 3 / 100.f);
-            Vector3i bbMax = config.environment.coordsToIndices(filament.position + filament.sigma * 3 / 100.f);
+            if (pass == 1)
+            {
+                for (size_t i = 2; i < tileStart.size(); i++)
+                    tileStart[i] += tileStart[i - 1];
+                tileFilaments.resize(tileStart.back());
+            }
+
+            for (size_t i = 0; i < filaments.size(); i++)
+            {
+                Vector3i bbMin, bbMax;
+                filamentBounds(filaments[i], bbMin, bbMax);
+                Vector3i tileMin = bbMin / concentrationTileSize;
+                Vector3i tileMax = bbMax / concentrationTileSize;
+                for (int z = tileMin.z; z <= tileMax.z; z++)
+                    for (int y = tileMin.y; y <= tileMax.y; y++)
+                        for (int x = tileMin.x; x <= tileMax.x; x++)
+                        {
+                            size_t tile = indexFrom3D({x, y, z}, numTiles);
+                            if (pass == 0)
+                                tileStart[tile + 2]++;
+                            else
+                                tileFilaments[tileStart[tile + 1]++] = i;
+                        }
+            }
+        }
 
-            bbMin.x = std::max(bbMin.x, 0);
-            bbMin.y = std::max(bbMin.y, 0);
-            bbMin.z = std::max(bbMin.z, 0);
+        const uint8_t* clearance = environment.clearance.data();
+        std::vector<float>& grid = *concentrations;
+#pragma omp parallel for schedule(dynamic)
+        for (size_t tile = 0; tile < totalTiles; tile++)
+        {
+            Vector3i tileMin = indicesFrom1D(tile, numTiles) * concentrationTileSize;
+            Vector3i tileMax;
+            for (int axis = 0; axis < 3; axis++)
+                tileMax[axis] = std::min(tileMin[axis] + concentrationTileSize, dimensions[axis]) - 1;
 
-            bbMax.x = std::min(bbMax.x, config.environment.description.dimensions.x);
-            bbMax.y = std::min(bbMax.y, config.environment.description.dimensions.y);
-            bbMax.z = std::min(bbMax.z, config.environment.description.dimensions.z);
+            for (int z = tileMin.z; z <= tileMax.z; z++)
+                for (int y = tileMin.y; y <= tileMax.y; y++)
+                    std::fill_n(&grid[environment.indexFrom3D({tileMin.x, y, z})], tileMax.x - tileMin.x + 1, 0.f);
 
-#pragma parallel for collapse(3)
-            for (size_t x = bbMin.x; x < bbMax.x; x++)
-                for (size_t y = bbMin.y; y < bbMax.x; y++)
-                    for (size_t z = bbMin.z; z < bbMax.z; z++)
+            for (uint32_t i = tileStart[tile]; i < tileStart[tile + 1]; i++)
+            {
+                const Filament& filament = filaments[tileFilaments[i]];
+                Vector3i bbMin, bbMax;
+                filamentBounds(filament, bbMin, bbMax);
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    bbMin[axis] = std::max(bbMin[axis], tileMin[axis]);
+                    bbMax[axis] = std::min(bbMax[axis], tileMax[axis]);
+                }
+
+                // cells whose center is within the clearance of the filament's cell are visible from the filament, so the line of sight only needs to be checked cell by cell past that distance
+                float visibleDistance = 0; //[m]
+                Vector3i filamentCell = environment.coordsToIndices(filament.position);
+                if (environment.IsInBounds(filamentCell))
+                    visibleDistance = clearance[environment.indexFrom3D(filamentCell)] * environment.description.cellSize;
+
+                // the gaussian is separable: exp(-d²/2s²) = exp(-dx²/2s²) * exp(-dy²/2s²) * exp(-dz²/2s²), so the exponentials are computed once per row, column and layer of the block
+                // the distances are also kept per axis, for the cutoff and visibility checks
+                std::array<float, concentrationTileSize> factors[3], distancesSqr[3];
+                float exponentScale = -(100.f * 100.f) / (2 * filament.sigma * filament.sigma); // distances are in m, sigma in cm
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    for (int i = 0; i <= bbMax[axis] - bbMin[axis]; i++)
+                    {
+                        float distance = environment.description.minCoord[axis] + (bbMin[axis] + i + 0.5f) * environment.description.cellSize - filament.position[axis];
+                        distancesSqr[axis][i] = distance * distance;
+                        factors[axis][i] = std::exp(exponentScale * distance * distance);
+                    }
+                }
+
+                float limitDistance = FilamentGrid::CutoffRadius(filament);
+                float limitSqr = limitDistance * limitDistance;
+                float visibleSqr = visibleDistance * visibleDistance;
+                float farthestSqr = 0; // from the filament to the farthest cell center of the block
+                for (int axis = 0; axis < 3; axis++)
+                    farthestSqr += std::max(distancesSqr[axis][0], distancesSqr[axis][bbMax[axis] - bbMin[axis]]);
+                bool blockVisible = farthestSqr < visibleSqr;
+
+                float centerConcentration = ConcentrationAtCenter(filament);
+                int rowLength = bbMax.x - bbMin.x + 1;
+                for (int z = bbMin.z; z <= bbMax.z; z++)
+                    for (int y = bbMin.y; y <= bbMax.y; y++)
                     {
-                        Vector3i indices{x, y, z};
-                        Vector3 samplePoint = config.environment.coordsOfCellCenter(indices);
-                        if (CheckLineOfSight(filament.position, samplePoint))
-                            (*concentrations)[config.environment.indexFrom3D(indices)] += CalculateConcentrationSingleFilament(filament, samplePoint);
+                        int j = y - bbMin.y, k = z - bbMin.z;
+                        float rowConcentration = centerConcentration * factors[1][j] * factors[2][k];
+                        float rowDistanceSqr = distancesSqr[1][j] + distancesSqr[2][k];
+                        float* row = &grid[environment.indexFrom3D({bbMin.x, y, z})];
+
+                        // same criteria as CalculateConcentration (3 sigma cutoff and line of sight), so the grid holds what SampleConcentration would return at the center of each cell
+                        if (blockVisible)
+                        {
+#pragma omp simd
+                            for (int i = 0; i < rowLength; i++)
+                                row[i] += rowDistanceSqr + distancesSqr[0][i] < limitSqr ? rowConcentration * factors[0][i] : 0.f;
+                        }
+                        else
+                        {
+                            for (int i = 0; i < rowLength; i++)
+                            {
+                                float distanceSqr = rowDistanceSqr + distancesSqr[0][i];
+                                if (distanceSqr >= limitSqr)
+                                    continue;
+                                if (distanceSqr < visibleSqr || CheckLineOfSight(environment.coordsOfCellCenter({bbMin.x + i, y, z}), filament.position))
+                                    row[i] += rowConcentration * factors[0][i];
+                            }
+                        }
                     }
+            }
         }
     }
 
     void RunningSimulation::SaveResults()
     {
-        // check we can create the file
-        std::filesystem::path savePath = parameters.saveDataDirectory;
-
-        // Configure file name for saving the current snapshot
-        std::filesystem::path path = fmt::format("{}/iteration_{}", savePath, last_saved_step);
-
-        // write all the data as-is into a buffer, which we will then compress
-        BufferWriter writer((char*)rawBuffer.data(), rawBuffer.size());
+        // write all the data as-is into a buffer, which the ResultsWriter will then compress and write to disk
+        std::vector<uint8_t> rawBuffer = resultsWriter->AcquireBuffer();
+        BufferWriter writer(rawBuffer);
 
         writer.Write(&gaden::versionMajor);
         writer.Write(&gaden::versionMinor);
@@ -304,11 +724,21 @@ namespace gaden
         int windIndex = config.windSequence.GetCurrentIndex();
         writer.Write(&windIndex); // index of the wind file (they are stored separately under (results_location)/wind/... )
 
-        if (!parameters.preCalculateConcentrations)
+        if (!parameters.preCalculateConcentrations && parameters.saveKeyframeInterval > 0)
+            WriteFilamentsDelta(writer);
+        else if (!parameters.preCalculateConcentrations && parameters.saveQuantized)
+        {
+            std::string mode("filaments_quantized");
+            writer.Write(&mode);
+            GetFilaments(); // make sure the AoS copy is up to date
+            WriteQuantizedFilaments(writer, filamentsView, config.environment.description.minCoord, config.environment.description.maxCoord);
+        }
+        else if (!parameters.preCalculateConcentrations)
         {
             std::string mode("filaments");
             writer.Write(&mode);
-            writer.Write(activeFilaments);
+            GetFilaments(); // make sure the AoS copy is up to date
+            WriteFilamentArray(writer, filamentsView);
         }
         else
         {
@@ -317,17 +747,54 @@ namespace gaden
             writer.Write(&(*concentrations));
         }
 
-        // compression with zlib
-        zlib::uLongf destLength = compressedBuffer.size();
-        zlib::compress2(compressedBuffer.data(), &destLength, rawBuffer.data(), writer.currentOffset(), Z_DEFAULT_COMPRESSION);
-
-        // write to disk
-        std::ofstream results_file(path);
-        results_file.write((char*)compressedBuffer.data(), destLength);
-        results_file.close();
+        size_t numFilaments = parameters.preCalculateConcentrations ? 0 : activeFilaments->size();
+        resultsWriter->Submit(std::move(rawBuffer), last_saved_step, currentTime, numFilaments);
         last_saved_step++;
     }
 
+    // pads so the filament array is aligned within the file, which lets playback use it in place instead of copying it out
+    void RunningSimulation::WriteFilamentArray(BufferWriter& writer, std::vector<Filament>& filamentArray)
+    {
+        constexpr uint8_t zeros[alignof(Filament)] = {};
+        uint8_t padding = (alignof(Filament) - (writer.currentOffset() + sizeof(padding) + sizeof(size_t)) % alignof(Filament)) % alignof(Filament);
+        writer.Write(&padding);
+        writer.Write(zeros, padding);
+        writer.Write(&filamentArray);
+    }
+
+    // keyframe every saveKeyframeInterval snapshots, and the changes since the previous snapshot in between (see FilamentDelta.hpp)
+    void RunningSimulation::WriteFilamentsDelta(BufferWriter& writer)
+    {
+        FilamentFrame& current = unsavedFrame;
+        GetFilaments(); // make sure the AoS copy is up to date
+        current.filaments = filamentsView;
+        current.ids.resize(activeFilaments->size());
+        for (size_t i = 0; i < activeFilaments->size(); i++)
+            current.ids[i] = activeFilaments->id[i];
+
+        // a delta needs a previous snapshot, and both of them sorted by id (which the simulation always keeps, but better safe than sorry)
+        bool keyframe = last_saved_step % parameters.saveKeyframeInterval == 0 || !SortedByID(current.ids);
+        if (keyframe)
+        {
+            std::string mode("filament_keyframe");
+            writer.Write(&mode);
+            writer.Write(&current.ids);
+            WriteFilamentArray(writer, current.filaments);
+            lastKeyframe = last_saved_step;
+        }
+        else
+        {
+            std::string mode("filament_delta");
+            writer.Write(&mode);
+            size_t baseIteration = last_saved_step - 1;
+            writer.Write(&lastKeyframe);
+            writer.Write(&baseIteration);
+            WriteFilamentDelta(writer, savedFrame, current);
+        }
+
+        std::swap(savedFrame, unsavedFrame);
+    }
+
     void RunningSimulation::Parameters::ReadFromYAML(std::filesystem::path const& path)
     {
         try
@@ -354,9 +821,21 @@ namespace gaden
             FromYAML<float>     (yaml, "filamentGrowthGamma",       filamentGrowthGamma);
             FromYAML<float>     (yaml, "filamentNoise_std",         filamentNoise_std);
             FromYAML<float>     (yaml, "numFilaments_sec",          numFilaments_sec);
-            FromYAML<size_t>    (yaml, "expectedNumIterations",     expectedNumIterations);
+            FromYAML<float>     (yaml, "filamentMinPPMcenter",      filamentMinPPMcenter);
+            FromYAML<float>     (yaml, "filamentMaxAge",            filamentMaxAge);
+            FromYAML<size_t>    (yaml, "maxActiveFilaments",        maxActiveFilaments);
+            FromYAML<float>     (yaml, "mergeMinSigma",             mergeMinSigma);
+            FromYAML<size_t>    (yaml, "maxCollisionBounces",       maxCollisionBounces);
+            FromYAML<uint64_t>  (yaml, "seed",                      seed);
             FromYAML<bool>      (yaml, "saveResults",               saveResults);
             FromYAML<float>     (yaml, "saveDeltaTime",             saveDeltaTime);
+            FromYAML<size_t>    (yaml, "saveQueueDepth",            saveQueueDepth);
+            FromYAML<bool>      (yaml, "saveSingleFile",            saveSingleFile);
+            FromYAML<size_t>    (yaml, "saveKeyframeInterval",      saveKeyframeInterval);
+            FromYAML<bool>      (yaml, "saveQuantized",             saveQuantized);
+            FromYAML<int>       (yaml, "saveCompressionLevel",      saveCompressionLevel);
+            if (auto codecNode = yaml["saveCompression"]; codecNode && !CodecFromName(codecNode.as<std::string>(), saveCompression))
+                GADEN_WARN("Invalid compression codec '{}'. Using {}", codecNode.as<std::string>(), CodecName(saveCompression));
             FromYAML<bool>      (yaml, "preCalculateConcentrations",preCalculateConcentrations);
             // clang-format on
 
@@ -388,9 +867,20 @@ namespace gaden
             emitter << YAML::Key << "filamentGrowthGamma"       << YAML::Value << filamentGrowthGamma;
             emitter << YAML::Key << "filamentNoise_std"         << YAML::Value << filamentNoise_std;
             emitter << YAML::Key << "numFilaments_sec"          << YAML::Value << numFilaments_sec;
-            emitter << YAML::Key << "expectedNumIterations"     << YAML::Value << expectedNumIterations;
+            emitter << YAML::Key << "filamentMinPPMcenter"      << YAML::Value << filamentMinPPMcenter;
+            emitter << YAML::Key << "filamentMaxAge"            << YAML::Value << filamentMaxAge;
+            emitter << YAML::Key << "maxActiveFilaments"        << YAML::Value << maxActiveFilaments;
+            emitter << YAML::Key << "mergeMinSigma"             << YAML::Value << mergeMinSigma;
+            emitter << YAML::Key << "maxCollisionBounces"       << YAML::Value << maxCollisionBounces;
+            emitter << YAML::Key << "seed"                      << YAML::Value << seed;
             emitter << YAML::Key << "saveResults"               << YAML::Value << saveResults;
             emitter << YAML::Key << "saveDeltaTime"             << YAML::Value << saveDeltaTime;
+            emitter << YAML::Key << "saveQueueDepth"            << YAML::Value << saveQueueDepth;
+            emitter << YAML::Key << "saveSingleFile"            << YAML::Value << saveSingleFile;
+            emitter << YAML::Key << "saveKeyframeInterval"      << YAML::Value << saveKeyframeInterval;
+            emitter << YAML::Key << "saveQuantized"             << YAML::Value << saveQuantized;
+            emitter << YAML::Key << "saveCompression"           << YAML::Value << CodecName(saveCompression);
+            emitter << YAML::Key << "saveCompressionLevel"      << YAML::Value << saveCompressionLevel;
             emitter << YAML::Key << "preCalculateConcentrations"<< YAML::Value << preCalculateConcentrations;
             // clang-format on
 
@@ -1,5 +1,6 @@
 #include "gaden/Scene.hpp"
 #include "YAML_Conversions.hpp"
+#include <algorithm>
 #include <fstream>
 
 namespace gaden
@@ -136,6 +137,36 @@ namespace gaden
         return gases;
     }
 
+    std::vector<GasType> Scene::GetDistinctGasTypes() const
+    {
+        std::vector<GasType> types;
+        for (const auto& sim : simulations)
+        {
+            GasType type = sim->simulationMetadata.source->gasType;
+            if (std::find(types.begin(), types.end(), type) == types.end())
+                types.push_back(type);
+        }
+        return types;
+    }
+
+    void Scene::SampleConcentrations(std::span<const Vector3> points, std::span<float> results) const
+    {
+        std::vector<GasType> types = GetDistinctGasTypes();
+        GADEN_VERIFY(results.size() == points.size() * types.size(), "SampleConcentrations needs one result per point and gas type");
+
+        std::fill(results.begin(), results.end(), 0.f);
+        std::vector<float> simulationResults(points.size());
+        for (const auto& sim : simulations)
+        {
+            size_t gasIndex = std::find(types.begin(), types.end(), sim->simulationMetadata.source->gasType) - types.begin();
+            std::span<float> gasResults = results.subspan(gasIndex * points.size(), points.size());
+
+            sim->SampleConcentrations(points, simulationResults);
+            for (size_t i = 0; i < points.size(); i++)
+                gasResults[i] += simulationResults[i];
+        }
+    }
+
     std::vector<GasType> Scene::GetGasTypes()
     {
         std::vector<GasType> types;
@@ -1,54 +1,88 @@
 #include "gaden/core/Logging.hpp"
+#include "gaden/internal/VoxelTraversal.hpp"
+#include <algorithm>
 #include <gaden/Simulation.hpp>
 
 namespace gaden
 {
     bool Simulation::CheckLineOfSight(Vector3 start, Vector3 end) const
     {
+        const Environment& environment = config.environment;
+
         // Check whether one of the points is outside the valid environment or is not free
-        if (config.environment.at(start) != Environment::CellState::Free || config.environment.at(end) != Environment::CellState::Free)
+        Vector3i startCell = environment.coordsToIndices(start);
+        if (!environment.IsInBounds(startCell) || environment.at(end) != Environment::CellState::Free)
+            return false;
+        size_t startIndex = environment.indexFrom3D(startCell);
+        if (environment.cells[startIndex] != Environment::CellState::Free)
             return false;
 
-        // Calculate displacement vector
-        Vector3 vector = end - start;
-        float distance = vmath::length(vector);
-        vector = vector / distance;
-
-        // Traverse path
-        int steps = distance / config.environment.description.cellSize; // Make sure no two iteration steps are separated more than 1 cell
-        float increment = distance / steps;
-
-        for (int i = 1; i < steps; i++)
+        // the clearance of a cell says how far the segment can go from there without reaching anything that is not free. In open space, that answers it right away
+        float length = vmath::length(end - start) / environment.description.cellSize; //[cells]
+        if (length < environment.clearance[startIndex])
+            return true;
+
+        // Check every cell crossed by the segment
+        // if it gets to a cell with enough clearance, the part of the segment that is covered by it is skipped
+        constexpr uint8_t minJump = 4; //[cells] shorter jumps are not worth restarting the traversal for
+        float t = 0;                   //[cells] distance along the segment up to which it is known to be clear
+        Vector3 from = start;
+        while (true)
         {
-            // Determine point in space to evaluate
-            Vector3 position = start + vector * (increment * i);
-
-            // Check if the cell is occupied
-            if (config.environment.at(position) != Environment::CellState::Free)
-                return false;
+            VoxelTraversal traversal(environment, from, end);
+            bool jumped = false;
+            while (!jumped && traversal.Next())
+            {
+                if (traversal.State() != Environment::CellState::Free)
+                    return false;
+
+                uint8_t clearance = environment.clearance[traversal.Index()];
+                if (clearance >= minJump)
+                {
+                    // the point where the segment enters the cell is on its boundary, so it is covered by the clearance of the cell too
+                    float entry = t + traversal.entryT * (length - t);
+                    if (length - entry < clearance)
+                        return true;
+
+                    t = entry + clearance - 0.5f; // stays strictly inside the clear distance, so the point where it continues is free
+                    from = start + (end - start) * (t / length);
+                    jumped = true;
+                }
+            }
+
+            if (!jumped)
+                return true; // Direct line of sight confirmed!
         }
-
-        // Direct line of sight confirmed!
-        return true;
     }
 
     float Simulation::CalculateConcentration(const Vector3& samplePoint) const
     {
         float gas_conc = 0;
-        const auto& activeFilaments = GetFilaments();
-        for (auto it = activeFilaments.begin(); it != activeFilaments.end(); it++)
-        {
-            const Filament& fil = *it;
+        GetFilamentGrid().ForEachNear(samplePoint, [&](const Filament& fil) {
             float distanceSqr = vmath::sqrlength(fil.position - samplePoint);
 
-            float limitDistance = fil.sigma * 3 / 100.f; // arbitrary cutoff point at 3 sigma
+            float limitDistance = FilamentGrid::CutoffRadius(fil); // arbitrary cutoff point at 3 sigma
             if (distanceSqr < limitDistance * limitDistance && CheckLineOfSight(samplePoint, fil.position))
                 gas_conc += CalculateConcentrationSingleFilament(fil, samplePoint);
-        }
+        });
 
         return gas_conc;
     }
 
+    const FilamentGrid& Simulation::GetFilamentGrid() const
+    {
+        if (filamentGridDirty)
+        {
+            std::lock_guard<std::mutex> lock(filamentGridMutex);
+            if (filamentGridDirty) // someone else might have built it while we waited for the lock
+            {
+                filamentGrid.Build(GetFilaments(), config.environment.description.minCoord, config.environment.description.maxCoord);
+                filamentGridDirty = false;
+            }
+        }
+        return filamentGrid;
+    }
+
     float Simulation::CalculateConcentrationSingleFilament(const Filament& filament, const Vector3& samplePoint) const
     {
         // calculate how much gas concentration does one filament contribute to the queried location
@@ -64,7 +98,7 @@ namespace gaden
     {
         constexpr float pi_cubed = M_PI * M_PI * M_PI;
 
-        float numMolesTarget_cm3 = simulationMetadata.constants.totalMolesInFilament //
+        float numMolesTarget_cm3 = filament.weight * simulationMetadata.constants.totalMolesInFilament //
                                    / (sqrt(8 * pi_cubed) * filament.sigma * filament.sigma * filament.sigma);
 
         return 1e6 * numMolesTarget_cm3 / simulationMetadata.constants.numMolesAllGasesIncm3; // express in ppm
@@ -84,6 +118,108 @@ namespace gaden
             return CalculateConcentration(samplePoint);
     }
 
+    void Simulation::SampleConcentrations(std::span<const Vector3> points, std::span<float> results) const
+    {
+        GADEN_VERIFY(points.size() == results.size(), "SampleConcentrations needs one result per point");
+
+        size_t outOfBounds = 0;
+        if (concentrations)
+        {
+#pragma omp parallel for reduction(+ : outOfBounds)
+            for (size_t i = 0; i < points.size(); i++)
+            {
+                if (!config.environment.IsInBounds(points[i]))
+                {
+                    results[i] = 0;
+                    outOfBounds++;
+                }
+                else
+                    results[i] = (*concentrations)[config.environment.indexFrom3D(config.environment.coordsToIndices(points[i]))];
+            }
+        }
+        else
+        {
+            // points in the same cell of the grid have the same nearby filaments, so they are grouped together and the filaments are only gathered once per group
+            const FilamentGrid& grid = GetFilamentGrid();
+            std::vector<std::pair<size_t, size_t>> sortedPoints(points.size()); // (cell, index of the point)
+            for (size_t i = 0; i < points.size(); i++)
+                sortedPoints[i] = {grid.CellIndex(points[i]), i};
+            std::sort(sortedPoints.begin(), sortedPoints.end());
+
+            std::vector<size_t> groupStart;
+            for (size_t i = 0; i < sortedPoints.size(); i++)
+            {
+                if (i == 0 || sortedPoints[i].first != sortedPoints[i - 1].first)
+                    groupStart.push_back(i);
+            }
+            groupStart.push_back(sortedPoints.size());
+
+#pragma omp parallel
+            {
+                // nearby filaments of the current group, as separate arrays so the distance check can be vectorized
+                std::vector<const Filament*> nearby;
+                std::vector<float> x, y, z, limitSqr;
+                std::vector<uint8_t> inRange;
+
+#pragma omp for schedule(dynamic) reduction(+ : outOfBounds)
+                for (size_t group = 0; group < groupStart.size() - 1; group++)
+                {
+                    nearby.clear();
+                    grid.ForEachRangeNear(points[sortedPoints[groupStart[group]].second], [&](const Filament* begin, const Filament* end) {
+                        for (const Filament* filament = begin; filament != end; filament++)
+                            nearby.push_back(filament);
+                    });
+
+                    size_t numNearby = nearby.size();
+                    x.resize(numNearby);
+                    y.resize(numNearby);
+                    z.resize(numNearby);
+                    limitSqr.resize(numNearby);
+                    inRange.resize(numNearby);
+                    for (size_t j = 0; j < numNearby; j++)
+                    {
+                        x[j] = nearby[j]->position.x;
+                        y[j] = nearby[j]->position.y;
+                        z[j] = nearby[j]->position.z;
+                        float limitDistance = FilamentGrid::CutoffRadius(*nearby[j]);
+                        limitSqr[j] = limitDistance * limitDistance;
+                    }
+
+                    for (size_t i = groupStart[group]; i < groupStart[group + 1]; i++)
+                    {
+                        size_t pointIndex = sortedPoints[i].second;
+                        const Vector3& samplePoint = points[pointIndex];
+                        if (!config.environment.IsInBounds(samplePoint))
+                        {
+                            results[pointIndex] = 0;
+                            outOfBounds++;
+                            continue;
+                        }
+
+#pragma omp simd
+                        for (size_t j = 0; j < numNearby; j++)
+                        {
+                            float dx = x[j] - samplePoint.x, dy = y[j] - samplePoint.y, dz = z[j] - samplePoint.z;
+                            inRange[j] = dx * dx + dy * dy + dz * dz < limitSqr[j];
+                        }
+
+                        // same order as CalculateConcentration, so the results are identical to those of SampleConcentration
+                        float gas_conc = 0;
+                        for (size_t j = 0; j < numNearby; j++)
+                        {
+                            if (inRange[j] && CheckLineOfSight(samplePoint, nearby[j]->position))
+                                gas_conc += CalculateConcentrationSingleFilament(*nearby[j], samplePoint);
+                        }
+                        results[pointIndex] = gas_conc;
+                    }
+                }
+            }
+        }
+
+        if (outOfBounds > 0)
+            GADEN_ERROR("Requested gas concentration at {} points outside the environment. Are you using the correct coordinates?", outOfBounds);
+    }
+
     Vector3 Simulation::SampleWind(const Vector3i& indices) const
     {
         return config.windSequence.GetCurrent().at(config.environment.indexFrom3D(indices));
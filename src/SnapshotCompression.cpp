@@ -0,0 +1,451 @@
+#include "gaden/core/Logging.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <gaden/internal/SnapshotCompression.hpp>
+#include <gaden/internal/compression.hpp>
+#include <istream>
+#include <ostream>
+
+#ifndef GADEN_WITH_ZSTD
+#define GADEN_WITH_ZSTD 0
+#endif
+#if GADEN_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#ifndef GADEN_WITH_LZ4
+#define GADEN_WITH_LZ4 0
+#endif
+#if GADEN_WITH_LZ4
+#include <lz4.h>
+#endif
+
+namespace gaden
+{
+    bool CodecAvailable(CompressionCodec codec)
+    {
+        switch (codec)
+        {
+        case CompressionCodec::None:
+        case CompressionCodec::Zlib:
+            return true;
+        case CompressionCodec::Zstd:
+            return GADEN_WITH_ZSTD;
+        case CompressionCodec::LZ4:
+            return GADEN_WITH_LZ4;
+        }
+        return false;
+    }
+
+    std::string CodecName(CompressionCodec codec)
+    {
+        switch (codec)
+        {
+        case CompressionCodec::None:
+            return "none";
+        case CompressionCodec::Zlib:
+            return "zlib";
+        case CompressionCodec::Zstd:
+            return "zstd";
+        case CompressionCodec::LZ4:
+            return "lz4";
+        }
+        return "unknown";
+    }
+
+    bool CodecFromName(const std::string& name, CompressionCodec& codec)
+    {
+        for (CompressionCodec candidate : {CompressionCodec::None, CompressionCodec::Zlib, CompressionCodec::Zstd, CompressionCodec::LZ4})
+        {
+            if (name == CodecName(candidate))
+            {
+                codec = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Compression
+    //-------------------------------------------------
+    static bool CompressZlib(std::ostream& output, int level, const uint8_t* data, size_t dataSize, size_t& written)
+    {
+        using namespace zlib; // deflateInit is a macro that expects the zlib names to be visible
+        z_stream stream{};
+        if (deflateInit(&stream, level != 0 ? level : Z_DEFAULT_COMPRESSION) != Z_OK)
+            return false;
+
+        std::vector<uint8_t> block(snapshotStreamBlockSize);
+        size_t consumed = 0;
+        int result;
+        do
+        {
+            // avail_in is 32 bits, so very large snapshots are fed in pieces
+            if (stream.avail_in == 0 && consumed < dataSize)
+            {
+                size_t inputChunk = std::min<size_t>(dataSize - consumed, UINT_MAX);
+                stream.next_in = const_cast<Bytef*>(data + consumed);
+                stream.avail_in = inputChunk;
+                consumed += inputChunk;
+            }
+            stream.next_out = block.data();
+            stream.avail_out = block.size();
+            result = deflate(&stream, consumed == dataSize ? Z_FINISH : Z_NO_FLUSH);
+            size_t produced = block.size() - stream.avail_out;
+            output.write((char*)block.data(), produced);
+            written += produced;
+        } while (result == Z_OK || result == Z_BUF_ERROR);
+
+        deflateEnd(&stream);
+        return result == Z_STREAM_END;
+    }
+
+#if GADEN_WITH_ZSTD
+    static bool CompressZstd(std::ostream& output, int level, const uint8_t* data, size_t dataSize, size_t& written)
+    {
+        ZSTD_CCtx* context = ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level != 0 ? level : ZSTD_CLEVEL_DEFAULT);
+
+        std::vector<uint8_t> block(snapshotStreamBlockSize);
+        ZSTD_inBuffer input{data, dataSize, 0};
+        size_t remaining;
+        do
+        {
+            ZSTD_outBuffer out{block.data(), block.size(), 0};
+            remaining = ZSTD_compressStream2(context, &out, &input, ZSTD_e_end);
+            if (ZSTD_isError(remaining))
+                break;
+            output.write((char*)block.data(), out.pos);
+            written += out.pos;
+        } while (remaining != 0);
+
+        ZSTD_freeCCtx(context);
+        return !ZSTD_isError(remaining);
+    }
+#endif
+
+#if GADEN_WITH_LZ4
+    // lz4 has no streaming API outside of the frame format, so the data is split in independent blocks, each preceded by its compressed size (uint32)
+    static bool CompressLZ4(std::ostream& output, int level, const uint8_t* data, size_t dataSize, size_t& written)
+    {
+        std::vector<char> block(LZ4_compressBound(snapshotStreamBlockSize));
+        for (size_t offset = 0; offset < dataSize; offset += snapshotStreamBlockSize)
+        {
+            int blockSize = std::min(snapshotStreamBlockSize, dataSize - offset);
+            int acceleration = level > 0 ? level : 1; // for lz4 the level is the acceleration factor: higher -> faster, lower ratio
+            uint32_t compressedSize = LZ4_compress_fast((const char*)data + offset, block.data(), blockSize, block.size(), acceleration);
+            if (compressedSize == 0)
+                return false;
+            output.write((char*)&compressedSize, sizeof(compressedSize));
+            output.write(block.data(), compressedSize);
+            written += sizeof(compressedSize) + compressedSize;
+        }
+        return true;
+    }
+#endif
+
+    size_t CompressSnapshot(std::ostream& output, CompressionCodec codec, int level, const uint8_t* data, size_t dataSize)
+    {
+        if (!CodecAvailable(codec))
+            codec = CompressionCodec::None;
+
+        uint8_t header[snapshotHeaderSize] = {};
+        uint64_t rawSize = dataSize;
+        memcpy(header, snapshotMagic, sizeof(snapshotMagic));
+        header[4] = static_cast<uint8_t>(codec);
+        memcpy(header + 8, &rawSize, sizeof(rawSize));
+        output.write((char*)header, snapshotHeaderSize);
+
+        size_t written = snapshotHeaderSize;
+        bool ok = true;
+        switch (codec)
+        {
+        case CompressionCodec::Zlib:
+            ok = CompressZlib(output, level, data, dataSize, written);
+            break;
+#if GADEN_WITH_ZSTD
+        case CompressionCodec::Zstd:
+            ok = CompressZstd(output, level, data, dataSize, written);
+            break;
+#endif
+#if GADEN_WITH_LZ4
+        case CompressionCodec::LZ4:
+            ok = CompressLZ4(output, level, data, dataSize, written);
+            break;
+#endif
+        default:
+            output.write((char*)data, dataSize);
+            written += dataSize;
+            break;
+        }
+
+        if (!ok || !output)
+            return 0;
+        return written;
+    }
+
+    // Decompression
+    //-------------------------------------------------
+
+    // the compressed data, handed out in pieces of at most snapshotStreamBlockSize bytes
+    // from memory, the pieces point straight into the data. From a stream, they are read one by one into a small buffer
+    class MemorySource
+    {
+    public:
+        MemorySource(const uint8_t* _data, size_t _size)
+            : data(_data), remaining(_size)
+        {}
+
+        size_t Next(const uint8_t*& chunk, size_t maxSize = snapshotStreamBlockSize)
+        {
+            size_t size = std::min(maxSize, remaining);
+            chunk = data;
+            data += size;
+            remaining -= size;
+            return size;
+        }
+
+        size_t Remaining() const { return remaining; }
+
+    private:
+        const uint8_t* data;
+        size_t remaining;
+    };
+
+    class StreamSource
+    {
+    public:
+        StreamSource(std::istream& _stream, size_t _size)
+            : stream(_stream), remaining(_size), buffer(std::min(_size, snapshotStreamBlockSize))
+        {}
+
+        size_t Next(const uint8_t*& chunk, size_t maxSize = snapshotStreamBlockSize)
+        {
+            size_t size = std::min({maxSize, remaining, buffer.size()});
+            stream.read((char*)buffer.data(), size);
+            size = stream.gcount();
+            remaining -= size;
+            chunk = buffer.data();
+            return size;
+        }
+
+        size_t Remaining() const { return remaining; }
+
+    private:
+        std::istream& stream;
+        size_t remaining;
+        std::vector<uint8_t> buffer;
+    };
+
+    template <typename Source>
+    static bool ReadExactly(Source& source, uint8_t* destination, size_t size)
+    {
+        while (size > 0)
+        {
+            const uint8_t* chunk;
+            size_t read = source.Next(chunk, size);
+            if (read == 0)
+                return false;
+            memcpy(destination, chunk, read);
+            destination += read;
+            size -= read;
+        }
+        return true;
+    }
+
+    // 'prefix' is input that was already taken out of the source to look for the header
+    // knownSize -> outputSize comes in with the expected uncompressed size, and 'output' is already large enough
+    template <typename Source>
+    static bool DecompressZlib(Source& source, const uint8_t* prefix, size_t prefixSize, std::vector<uint8_t>& output, size_t& outputSize, bool knownSize)
+    {
+        using namespace zlib; // inflateInit is a macro that expects the zlib names to be visible
+        z_stream stream{};
+        if (inflateInit(&stream) != Z_OK)
+            return false;
+
+        // legacy files do not store the uncompressed size, so the output grows until everything fits
+        if (!knownSize && output.size() < snapshotStreamBlockSize)
+            output.resize(snapshotStreamBlockSize);
+
+        stream.next_in = const_cast<Bytef*>(prefix);
+        stream.avail_in = prefixSize;
+        size_t capacity = knownSize ? outputSize : output.size();
+        size_t produced = 0;
+        int result = Z_OK;
+        while (result == Z_OK)
+        {
+            if (stream.avail_in == 0)
+            {
+                const uint8_t* chunk;
+                stream.avail_in = source.Next(chunk);
+                stream.next_in = const_cast<Bytef*>(chunk);
+                if (stream.avail_in == 0)
+                    break;
+            }
+            if (produced == capacity)
+            {
+                if (knownSize)
+                    break;
+                output.resize(output.size() * 2);
+                capacity = output.size();
+            }
+            stream.next_out = output.data() + produced;
+            stream.avail_out = std::min<size_t>(capacity - produced, UINT_MAX);
+            size_t available = stream.avail_out;
+            result = inflate(&stream, Z_NO_FLUSH);
+            produced += available - stream.avail_out;
+        }
+
+        inflateEnd(&stream);
+        outputSize = produced;
+        return result == Z_STREAM_END;
+    }
+
+#if GADEN_WITH_ZSTD
+    template <typename Source>
+    static bool DecompressZstd(Source& source, std::vector<uint8_t>& output, size_t rawSize)
+    {
+        ZSTD_DCtx* context = ZSTD_createDCtx();
+        ZSTD_outBuffer out{output.data(), rawSize, 0};
+        size_t result = 1;
+        while (result != 0 && !ZSTD_isError(result))
+        {
+            const uint8_t* chunk;
+            size_t size = source.Next(chunk);
+            if (size == 0)
+                break;
+            ZSTD_inBuffer input{chunk, size, 0};
+            while (input.pos < input.size && result != 0 && !ZSTD_isError(result))
+                result = ZSTD_decompressStream(context, &out, &input);
+        }
+        ZSTD_freeDCtx(context);
+        return result == 0 && out.pos == rawSize;
+    }
+#endif
+
+#if GADEN_WITH_LZ4
+    template <typename Source>
+    static bool DecompressLZ4(Source& source, std::vector<uint8_t>& output, size_t rawSize)
+    {
+        std::vector<uint8_t> block(LZ4_compressBound(snapshotStreamBlockSize));
+        for (size_t offset = 0; offset < rawSize; offset += snapshotStreamBlockSize)
+        {
+            uint32_t compressedSize;
+            if (!ReadExactly(source, (uint8_t*)&compressedSize, sizeof(compressedSize)) || compressedSize > block.size()
+                || !ReadExactly(source, block.data(), compressedSize))
+                return false;
+
+            int blockSize = std::min(snapshotStreamBlockSize, rawSize - offset);
+            if (LZ4_decompress_safe((const char*)block.data(), (char*)output.data() + offset, compressedSize, blockSize) != blockSize)
+                return false;
+        }
+        return true;
+    }
+#endif
+
+    // how many times larger than its compressed data a snapshot can be with each codec
+    // used to reject the uncompressed size in a corrupted header before allocating for it
+    static uint64_t MaxExpansionRatio(CompressionCodec codec)
+    {
+        switch (codec)
+        {
+        case CompressionCodec::None:
+            return 1;
+        case CompressionCodec::Zlib:
+            return 1032; // limit of deflate
+        case CompressionCodec::Zstd:
+            return 1 << 15; // a 128 KB block can be stored as a 4 byte RLE block
+        case CompressionCodec::LZ4:
+            return 255;
+        }
+        return 0;
+    }
+
+    template <typename Source>
+    static bool Decompress(Source& source, std::vector<uint8_t>& output, size_t& outputSize, std::string* error)
+    {
+        uint8_t header[snapshotHeaderSize];
+        const uint8_t* chunk;
+        size_t headerRead = 0;
+        while (headerRead < snapshotHeaderSize)
+        {
+            size_t read = source.Next(chunk, snapshotHeaderSize - headerRead);
+            if (read == 0)
+                break;
+            memcpy(header + headerRead, chunk, read);
+            headerRead += read;
+        }
+
+        if (headerRead < snapshotHeaderSize || memcmp(header, snapshotMagic, sizeof(snapshotMagic)) != 0)
+            return DecompressZlib(source, header, headerRead, output, outputSize, false);
+
+        CompressionCodec codec = static_cast<CompressionCodec>(header[4]);
+        uint64_t rawSize;
+        memcpy(&rawSize, header + 8, sizeof(rawSize));
+
+        if (!CodecAvailable(codec))
+        {
+            if (error)
+                *error = fmt::format("it was compressed with '{}', which this build of gaden does not support", CodecName(codec));
+            return false;
+        }
+
+        if (rawSize / MaxExpansionRatio(codec) > source.Remaining())
+        {
+            if (error)
+                *error = fmt::format("corrupted header, it claims {} bytes of data, which cannot come from the {} bytes that follow it", rawSize, source.Remaining());
+            return false;
+        }
+
+        if (output.size() < rawSize)
+            output.resize(rawSize);
+        outputSize = rawSize;
+
+        switch (codec)
+        {
+        case CompressionCodec::None:
+            return ReadExactly(source, output.data(), rawSize);
+        case CompressionCodec::Zlib:
+            return DecompressZlib(source, nullptr, 0, output, outputSize, true) && outputSize == rawSize;
+#if GADEN_WITH_ZSTD
+        case CompressionCodec::Zstd:
+            return DecompressZstd(source, output, rawSize);
+#endif
+#if GADEN_WITH_LZ4
+        case CompressionCodec::LZ4:
+            return DecompressLZ4(source, output, rawSize);
+#endif
+        default:
+            return false;
+        }
+    }
+
+    bool DecompressSnapshot(std::istream& input, size_t inputSize, std::vector<uint8_t>& output, size_t& outputSize, std::string* error)
+    {
+        StreamSource source(input, inputSize);
+        return Decompress(source, output, outputSize, error);
+    }
+
+    bool DecompressSnapshot(const uint8_t* data, size_t dataSize, std::vector<uint8_t>& output, size_t& outputSize, std::string* error)
+    {
+        MemorySource source(data, dataSize);
+        return Decompress(source, output, outputSize, error);
+    }
+
+    bool UncompressedSnapshotPayload(const uint8_t* data, size_t dataSize, const uint8_t*& payload, size_t& payloadSize)
+    {
+        if (dataSize < snapshotHeaderSize || memcmp(data, snapshotMagic, sizeof(snapshotMagic)) != 0
+            || static_cast<CompressionCodec>(data[4]) != CompressionCodec::None)
+            return false;
+
+        uint64_t rawSize;
+        memcpy(&rawSize, data + 8, sizeof(rawSize));
+        if (rawSize > dataSize - snapshotHeaderSize)
+            return false;
+
+        payload = data + snapshotHeaderSize;
+        payloadSize = rawSize;
+        return true;
+    }
+} // namespace gaden
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <gaden/internal/SnapshotPrefetcher.hpp>
+
+namespace gaden
+{
+    SnapshotPrefetcher::SnapshotPrefetcher(DecodeFunction decodeFunction, NextFunction nextFunction, size_t prefetchDepth, size_t budget, size_t numThreads)
+        : decode(std::move(decodeFunction)), next(std::move(nextFunction)), depth(std::max<size_t>(prefetchDepth, 1)), memoryBudget(budget)
+    {
+        numThreads = std::max<size_t>(numThreads, 1);
+        for (size_t i = 0; i < numThreads; i++)
+            workers.emplace_back(&SnapshotPrefetcher::WorkerLoop, this, i);
+    }
+
+    SnapshotPrefetcher::~SnapshotPrefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        frameQueued.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    bool SnapshotPrefetcher::Take(size_t iteration, std::vector<uint8_t>& buffer, size_t& size)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (frames.empty() || frames.front().iteration != iteration)
+            Restart(iteration);
+
+        frameDone.wait(lock, [this] { return frames.front().state == FrameState::Ready || frames.front().state == FrameState::Failed; });
+
+        Frame& frame = frames.front();
+        bool ok = frame.state == FrameState::Ready;
+        if (ok)
+        {
+            std::swap(buffer, frame.buffer);
+            size = frame.size;
+            RecycleBuffer(std::move(frame.buffer)); // the caller's previous buffer
+        }
+        frames.pop_front();
+        Schedule();
+        return ok;
+    }
+
+    void SnapshotPrefetcher::Skip(size_t iteration)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (frames.empty() || frames.front().iteration != iteration)
+        {
+            Restart(next(iteration));
+            return;
+        }
+
+        RecycleBuffer(std::move(frames.front().buffer)); // if it is still being decoded, the worker recycles it when it finds the frame gone
+        frames.pop_front();
+        if (frames.empty())
+            frames.push_back(Frame{.sequence = nextSequence++, .iteration = next(iteration)});
+        Schedule();
+    }
+
+    // drops everything that was read ahead, and continues from 'iteration' instead
+    void SnapshotPrefetcher::Restart(size_t iteration)
+    {
+        for (Frame& frame : frames)
+            RecycleBuffer(std::move(frame.buffer)); // frames that are being decoded right now have no buffer yet. Their worker recycles it when it finds the frame gone
+        frames.clear();
+        frames.push_back(Frame{.sequence = nextSequence++, .iteration = iteration});
+        Schedule();
+    }
+
+    // queues more iterations, as long as there is room in the pipeline
+    void SnapshotPrefetcher::Schedule()
+    {
+        // at least the next frame is always queued, whatever the budget
+        if (frames.empty())
+            return;
+
+        // do not keep reading past a snapshot that failed (most likely, the end of the results), it will be retried once the caller gets there
+        while (frames.size() < depth && frames.back().state != FrameState::Failed && (memoryBudget == 0 || BytesHeld() + expectedFrameSize <= memoryBudget))
+            frames.push_back(Frame{.sequence = nextSequence++, .iteration = next(frames.back().iteration)});
+
+        frameQueued.notify_all();
+    }
+
+    size_t SnapshotPrefetcher::BytesHeld() const
+    {
+        size_t bytes = 0;
+        for (const Frame& frame : frames)
+            bytes += frame.state == FrameState::Ready ? frame.buffer.capacity() : expectedFrameSize;
+        return bytes;
+    }
+
+    std::vector<uint8_t> SnapshotPrefetcher::TakeFreeBuffer()
+    {
+        if (freeBuffers.empty())
+            return {};
+        std::vector<uint8_t> buffer = std::move(freeBuffers.back());
+        freeBuffers.pop_back();
+        return buffer;
+    }
+
+    void SnapshotPrefetcher::RecycleBuffer(std::vector<uint8_t>&& buffer)
+    {
+        // no point in keeping more buffers around than could ever be in use at the same time
+        if (buffer.capacity() > 0 && freeBuffers.size() < depth + workers.size())
+            freeBuffers.push_back(std::move(buffer));
+    }
+
+    void SnapshotPrefetcher::WorkerLoop(size_t worker)
+    {
+        auto findQueued = [this]() { return std::find_if(frames.begin(), frames.end(), [](const Frame& frame) { return frame.state == FrameState::Queued; }); };
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            frameQueued.wait(lock, [&] { return stopping || findQueued() != frames.end(); });
+            if (stopping)
+                return;
+
+            auto frame = findQueued();
+            frame->state = FrameState::Decoding;
+            uint64_t sequence = frame->sequence;
+            size_t iteration = frame->iteration;
+            std::vector<uint8_t> buffer = TakeFreeBuffer();
+
+            lock.unlock();
+            size_t size = 0;
+            bool ok = decode(worker, iteration, buffer, size);
+            lock.lock();
+
+            // the deque might have changed in the meantime, so the frame is looked up again. If the caller jumped somewhere else, it is gone
+            if (frames.empty() || sequence < frames.front().sequence || sequence - frames.front().sequence >= frames.size())
+            {
+                RecycleBuffer(std::move(buffer));
+                continue;
+            }
+
+            Frame& decoded = frames[sequence - frames.front().sequence];
+            decoded.state = ok ? FrameState::Ready : FrameState::Failed;
+            decoded.buffer = std::move(buffer);
+            decoded.size = size;
+            if (ok)
+                expectedFrameSize = decoded.buffer.capacity();
+            frameDone.notify_all();
+        }
+    }
+} // namespace gaden
@@ -1,8 +1,7 @@
 #include "gaden/core/Assertions.hpp"
 #include "gaden/core/Logging.hpp"
-#include "gaden/internal/BufferUtils.hpp"
 #include <fstream>
-#include <gaden/internal/compression.hpp>
+#include <gaden/internal/SnapshotCompression.hpp>
 #include <iostream>
 #include <vector>
 
@@ -23,15 +22,15 @@ int main(int argc, char* argv[])
         size_t streamSize = infile.tellg();
         infile.seekg(0, std::ios_base::beg);
 
-        // read the compressed data to a buffer
-        std::vector<uint8_t> compressedBuffer(gaden::maxBufferSize);
-        infile.read((char*)compressedBuffer.data(), streamSize);
-        infile.close();
-
-        // decompress the contents
-        std::vector<uint8_t> rawBuffer(gaden::maxBufferSize);
-        zlib::uLongf bufferSize = rawBuffer.size();
-        zlib::uncompress(rawBuffer.data(), &bufferSize, compressedBuffer.data(), compressedBuffer.size());
+        // decompress the contents. The codec is detected from the file header
+        std::vector<uint8_t> rawBuffer;
+        size_t bufferSize;
+        std::string error;
+        if (!gaden::DecompressSnapshot(infile, streamSize, rawBuffer, bufferSize, &error))
+        {
+            GADEN_ERROR("Could not decompress '{}'{}", input, error.empty() ? "" : ": " + error);
+            return 1;
+        }
 
         // write out
         std::ofstream outfile(output);